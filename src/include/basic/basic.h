@@ -15,5 +15,6 @@
 #include "basic/singleton.h"
 #include "basic/string.h"
 #include "basic/sync.h"
+#include "basic/timer.h"
 
 #endif
@@ -4,6 +4,8 @@
 #ifndef BASIC_HANDLE_H
 #define BASIC_HANDLE_H
 
+#include <map>
+
 #include <boost/static_assert.hpp>
 #include <boost/utility.hpp>
 
@@ -61,6 +63,7 @@ struct handle_base: handle_owned_base<Derived, typename extract_owned<Derived>::
     {
       const HandleType ret = handle_;
       handle_ = Derived::InvalidValue();
+      return ret;
     }
 
     HandleType Handle() const { return handle_; }
@@ -123,6 +126,72 @@ struct generic_invalid_handle_base: invalid_handle_base<Derived>
     :invalid_handle_base<Derived>(nhandle) { }
 };
 
+// Owned handles can't be copied, so they can't be kept in standard containers
+// This map holds unowned copies of the handles instead, and closes them when they are
+//  erased or the map is destroyed.
+template <typename Key, template <typename> class Handle>
+class owned_handle_map: boost::noncopyable
+{
+  public:
+    typedef Handle<unowned> value_type;
+
+  private:
+    typedef std::map<Key, value_type> map_type;
+    map_type handles;
+
+    static void close(const value_type & handle)
+    {
+      Handle<owned> owner;
+      owner.Reset(handle.Handle());
+    }
+
+  public:
+    ~owned_handle_map() { clear(); }
+
+    // Returns an invalid handle if there is none for this key
+    value_type find(const Key & key) const
+    {
+      const typename map_type::const_iterator i = handles.find(key);
+      if (i == handles.end())
+        return value_type();
+      return i->second;
+    }
+
+    // Takes ownership of the handle, closing any handle already held for this key
+    // If this throws, the handle is still owned by the caller
+    value_type insert(const Key & key, Handle<owned> & handle)
+    {
+      const value_type ret(handle);
+      const std::pair<typename map_type::iterator, bool> i = handles.insert(std::make_pair(key, ret));
+      if (!i.second)
+      {
+        close(i.first->second);
+        i.first->second = ret;
+      }
+      handle.Release();
+      return ret;
+    }
+
+    void erase(const Key & key)
+    {
+      const typename map_type::iterator i = handles.find(key);
+      if (i == handles.end())
+        return;
+      close(i->second);
+      handles.erase(i);
+    }
+
+    void clear()
+    {
+      for (typename map_type::const_iterator i = handles.begin(); i != handles.end(); ++i)
+        close(i->second);
+      handles.clear();
+    }
+
+    bool empty() const { return handles.empty(); }
+    unsigned size() const { return handles.size(); }
+};
+
 // Assumes a class definition templated on a single type, called "Owned" with a typedef "base_type"
 // Defines default constructor, implicit conversion from handle type (for unowned types only),
 //  and conversion constructor from owned to unowned.
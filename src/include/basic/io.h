@@ -86,6 +86,43 @@ struct io_handle_base: generic_invalid_handle_base<Derived>
   }
 };
 
+template <typename Owned = unowned>
+struct file: io_handle_base<file<Owned> >
+{
+  typedef io_handle_base<file<Owned> > base_type;
+  TBA_DEFINE_HANDLE_CLASS(file, HANDLE)
+
+  void CreateFile(const LPCTSTR name, const DWORD access = GENERIC_READ, const DWORD share = FILE_SHARE_READ,
+      const DWORD disposition = OPEN_EXISTING, const DWORD flags = 0)
+  {
+    BOOST_STATIC_ASSERT(Owned::value);
+    this->Reset(::CreateFile(name, access, share, 0, disposition, flags, 0));
+  }
+  void create_file(const LPCTSTR name, const DWORD access = GENERIC_READ, const DWORD share = FILE_SHARE_READ,
+      const DWORD disposition = OPEN_EXISTING, const DWORD flags = 0)
+  {
+    BOOST_STATIC_ASSERT(Owned::value);
+    const HANDLE nhandle = ::CreateFile(name, access, share, 0, disposition, flags, 0);
+    if (nhandle == INVALID_HANDLE_VALUE)
+      throw Win32_error(TEXT("CreateFile (") + string(name) + TEXT(")"));
+    this->Reset(nhandle);
+  }
+
+  // Reads the rest of the file
+  ANSI_string read_to_end() const
+  {
+    ANSI_string ret;
+    char buf[4096];
+    while (true)
+    {
+      const DWORD size = this->read_file_sync(buf, sizeof(buf));
+      if (size == 0)
+        return ret;
+      ret.append(buf, size);
+    }
+  }
+};
+
 }
 
 #endif
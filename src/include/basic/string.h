@@ -35,6 +35,7 @@ static inline string safe_sprintf(const char_t * const format, ...)
 }
 
 static inline string to_string(const unsigned long x) { return safe_sprintf(TEXT("%u"), x); }
+static inline string ulonglong_to_string(const ULONGLONG x) { return safe_sprintf(TEXT("%I64u"), x); }
 
 static inline ANSI_string wide_char_to_multi_byte(const_UNICODE_str_ptr src, const UINT cp = CP_ACP)
 {
@@ -8,6 +8,31 @@
 
 namespace basic {
 
+// A critical section; it may be entered recursively by the thread that owns it
+class critical_section: boost::noncopyable
+{
+  private:
+    CRITICAL_SECTION cs;
+
+  public:
+    critical_section() { InitializeCriticalSection(&cs); }
+    ~critical_section() { DeleteCriticalSection(&cs); }
+
+    void enter() { EnterCriticalSection(&cs); }
+    void leave() { LeaveCriticalSection(&cs); }
+};
+
+// Holds a critical section for the lifetime of the object
+class critical_section_lock: boost::noncopyable
+{
+  private:
+    critical_section & cs;
+
+  public:
+    explicit critical_section_lock(critical_section & ncs):cs(ncs) { cs.enter(); }
+    ~critical_section_lock() { cs.leave(); }
+};
+
 template <typename Owned = unowned>
 struct event: generic_null_handle_base<event<Owned> >
 {
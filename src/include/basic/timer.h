@@ -0,0 +1,109 @@
+// Copyright 2005, Stephen Cleary
+// See the accompanying file "ntutils.chm" for licence information
+
+#ifndef BASIC_TIMER_H
+#define BASIC_TIMER_H
+
+#include "basic/sync.h"
+
+namespace basic {
+
+// Measures elapsed time using the high-resolution performance counter
+class performance_timer
+{
+  private:
+    LARGE_INTEGER start;
+
+    static LONGLONG frequency()
+    {
+      static LARGE_INTEGER ret = { { 0, 0 } };
+      if (ret.QuadPart == 0 && !QueryPerformanceFrequency(&ret))
+        ret.QuadPart = 1;
+      return ret.QuadPart;
+    }
+
+  public:
+    performance_timer() { restart(); }
+
+    void restart() { QueryPerformanceCounter(&start); }
+
+    // Returns the number of microseconds since construction or the last restart()
+    ULONGLONG elapsed_us() const
+    {
+      LARGE_INTEGER now;
+      QueryPerformanceCounter(&now);
+
+      // Split into whole seconds and the remainder, so the multiply can't overflow
+      const ULONGLONG ticks = (ULONGLONG) (now.QuadPart - start.QuadPart);
+      const ULONGLONG f = frequency();
+      return ticks / f * 1000000 + (ticks % f) * 1000000 / f;
+    }
+};
+
+// Counts values (usually microseconds) in power-of-two buckets: bucket 0 holds 0, and
+//  bucket n holds values from 2^(n-1) to 2^n - 1
+// Percentiles are only known to within a factor of two, which is enough to show where
+//  the time goes; the count, total, and maximum are exact.
+// Values may be added from several threads at once.
+class log2_histogram: boost::noncopyable
+{
+  private:
+    critical_section lock;
+    ULONGLONG buckets[65];
+    ULONGLONG count_;
+    ULONGLONG total_;
+    ULONGLONG max_;
+
+    static unsigned bucket(ULONGLONG value)
+    {
+      unsigned ret = 0;
+      for (; value != 0; value >>= 1)
+        ++ret;
+      return ret;
+    }
+
+  public:
+    log2_histogram()
+    :count_(0), total_(0), max_(0)
+    {
+      for (unsigned i = 0; i != 65; ++i)
+        buckets[i] = 0;
+    }
+
+    void add(const ULONGLONG value)
+    {
+      const unsigned i = bucket(value);
+      critical_section_lock guard(lock);
+      ++buckets[i];
+      ++count_;
+      total_ += value;
+      if (value > max_)
+        max_ = value;
+    }
+
+    // These should only be called once no more values are being added
+    ULONGLONG count() const { return count_; }
+    ULONGLONG total() const { return total_; }
+    ULONGLONG maximum() const { return max_; }
+
+    // Returns the upper bound of the bucket holding the given percentile (never more than maximum())
+    ULONGLONG percentile(const unsigned percent) const
+    {
+      const ULONGLONG wanted = (count_ * percent + 99) / 100;
+      ULONGLONG seen = 0;
+      for (unsigned i = 0; i != 65; ++i)
+      {
+        seen += buckets[i];
+        if (seen != 0 && seen >= wanted)
+        {
+          const ULONGLONG upper = (i == 0) ? 0 : (i == 64) ? max_ : ((ULONGLONG) 1 << i) - 1;
+          return (upper < max_) ? upper : max_;
+        }
+      }
+      return max_;
+    }
+};
+
+}
+
+#endif
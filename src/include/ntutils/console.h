@@ -292,6 +292,29 @@ class option_parser
     const char_t * argument;
 };
 
+// Parses the argument of an option that takes a duration: a number followed by
+//  "ms", "s" (the default), "m", or "h"; returns the duration in milliseconds
+static inline DWORD parse_duration_option(const option_parser & options)
+{
+  char_t * unit;
+  const DWORD value = _tcstoul(options.argument, &unit, 10);
+  DWORD multiplier = 0;
+  if (!_tcsicmp(unit, TEXT("ms")))
+    multiplier = 1;
+  else if (*unit == 0 || !_tcsicmp(unit, TEXT("s")))
+    multiplier = 1000;
+  else if (!_tcsicmp(unit, TEXT("m")))
+    multiplier = 60 * 1000;
+  else if (!_tcsicmp(unit, TEXT("h")))
+    multiplier = 60 * 60 * 1000;
+
+  // The duration must fit in a DWORD of milliseconds (about 49 days)
+  if (multiplier == 0 || unit == options.argument || value == 0 || value > 0xFFFFFFFF / multiplier)
+    throw option_error(string(TEXT("Invalid argument '")) + options.argument + TEXT("' for option --") +
+        options.option->long_option);
+  return value * multiplier;
+}
+
 }
 
 #endif
@@ -0,0 +1,214 @@
+// Copyright 2005, Stephen Cleary
+// See the accompanying file "ntutils.chm" for licence information
+
+#ifndef NTUTILS_CPU_MASK_H
+#define NTUTILS_CPU_MASK_H
+
+#include <vector>
+
+#include "ntutils/basic.h"
+#include "ntutils/message.h"
+
+namespace ntutils {
+
+// A set of CPUs, by number
+// The set may hold more CPUs than an affinity mask on this system (up to max_cpus), so that
+//  it can be passed to another computer; to_affinity_mask() checks that it fits.
+class cpu_mask
+{
+  public:
+    static const unsigned max_cpus = 1024;
+
+  private:
+    // Bit n of word w is CPU 32 * w + n
+    std::vector<DWORD> words;
+
+    static bool parse_number(const char_t * & text, unsigned & ret)
+    {
+      if (*text < TEXT('0') || *text > TEXT('9'))
+        return false;
+      ret = 0;
+      for (; *text >= TEXT('0') && *text <= TEXT('9'); ++text)
+      {
+        ret = ret * 10 + (*text - TEXT('0'));
+        if (ret >= max_cpus)
+          return false;
+      }
+      return true;
+    }
+
+    bool parse_hex(const char_t * const text)
+    {
+      const char_t * end = text;
+      while (*end != 0)
+        ++end;
+      if (end == text || (end - text) * 4 > (int) max_cpus)
+        return false;
+
+      // The last digit holds CPUs 0-3, the one before it CPUs 4-7, and so on
+      unsigned cpu = 0;
+      for (const char_t * i = end; i != text; cpu += 4)
+      {
+        --i;
+        unsigned digit;
+        if (*i >= TEXT('0') && *i <= TEXT('9'))
+          digit = *i - TEXT('0');
+        else if (*i >= TEXT('a') && *i <= TEXT('f'))
+          digit = *i - TEXT('a') + 10;
+        else if (*i >= TEXT('A') && *i <= TEXT('F'))
+          digit = *i - TEXT('A') + 10;
+        else
+          return false;
+
+        for (unsigned bit = 0; bit != 4; ++bit)
+          if (digit & (1 << bit))
+            set(cpu + bit);
+      }
+      return true;
+    }
+
+    bool parse_list(const char_t * text)
+    {
+      while (true)
+      {
+        unsigned first, last;
+        if (!parse_number(text, first))
+          return false;
+        last = first;
+        if (*text == TEXT('-'))
+        {
+          ++text;
+          if (!parse_number(text, last) || last < first)
+            return false;
+        }
+
+        for (unsigned cpu = first; cpu <= last; ++cpu)
+          set(cpu);
+
+        if (*text == 0)
+          return true;
+        if (*text != TEXT(','))
+          return false;
+        ++text;
+      }
+    }
+
+  public:
+    void set(const unsigned cpu)
+    {
+      if (cpu >= max_cpus)
+        throw error(TEXT("CPU ") + to_string(cpu) + TEXT(" is out of range"));
+      if (words.size() <= cpu / 32)
+        words.resize(cpu / 32 + 1);
+      words[cpu / 32] |= (DWORD) 1 << (cpu % 32);
+    }
+
+    bool test(const unsigned cpu) const
+    {
+      if (words.size() <= cpu / 32)
+        return false;
+      return ((words[cpu / 32] & ((DWORD) 1 << (cpu % 32))) != 0);
+    }
+
+    bool empty() const
+    {
+      for (std::vector<DWORD>::const_iterator i = words.begin(); i != words.end(); ++i)
+        if (*i != 0)
+          return false;
+      return true;
+    }
+
+    // Accepts a list of CPU numbers and ranges (e.g., "0-3,8"), or a hexadecimal mask (e.g., "0xF0")
+    // Returns false if the text is not valid
+    bool parse(const char_t * const text)
+    {
+      words.clear();
+      if (text[0] == TEXT('0') && (text[1] == TEXT('x') || text[1] == TEXT('X')))
+        return parse_hex(text + 2);
+      return parse_list(text);
+    }
+
+    // Returns a list of CPU numbers and ranges (e.g., "0-3,8")
+    string list() const
+    {
+      string ret;
+      const unsigned end = words.size() * 32;
+      for (unsigned cpu = 0; cpu < end; ++cpu)
+      {
+        if (!test(cpu))
+          continue;
+        unsigned last = cpu;
+        while (last + 1 < end && test(last + 1))
+          ++last;
+
+        if (!ret.empty())
+          ret += TEXT(',');
+        ret += to_string(cpu);
+        if (last != cpu)
+          ret += TEXT('-') + to_string(last);
+        cpu = last;
+      }
+      return ret;
+    }
+
+    // Returns a hexadecimal mask (e.g., "0xF0")
+    string hex() const
+    {
+      unsigned used = words.size();
+      while (used != 0 && words[used - 1] == 0)
+        --used;
+      if (used == 0)
+        return TEXT("0x0");
+
+      string ret = TEXT("0x") + safe_sprintf(TEXT("%X"), words[used - 1]);
+      for (unsigned i = used - 1; i != 0; --i)
+        ret += safe_sprintf(TEXT("%08X"), words[i - 1]);
+      return ret;
+    }
+
+    static cpu_mask from_affinity_mask(const DWORD_PTR mask)
+    {
+      cpu_mask ret;
+      for (unsigned cpu = 0; cpu != sizeof(DWORD_PTR) * 8; ++cpu)
+        if (mask & ((DWORD_PTR) 1 << cpu))
+          ret.set(cpu);
+      return ret;
+    }
+
+    // Throws if the set holds a CPU that can't be in an affinity mask on this system
+    DWORD_PTR to_affinity_mask() const
+    {
+      DWORD_PTR ret = 0;
+      for (unsigned cpu = 0; cpu != words.size() * 32; ++cpu)
+      {
+        if (!test(cpu))
+          continue;
+        if (cpu >= sizeof(DWORD_PTR) * 8)
+          throw error(TEXT("CPU ") + to_string(cpu) + TEXT(" can't be used in an affinity mask on this system"));
+        ret |= (DWORD_PTR) 1 << cpu;
+      }
+      return ret;
+    }
+
+    // Message format: DWORD of the number of words, followed by that many DWORDs
+    void encode(string & msg) const
+    {
+      encode_binary_data<DWORD>(msg, words.size());
+      for (std::vector<DWORD>::const_iterator i = words.begin(); i != words.end(); ++i)
+        encode_binary_data<DWORD>(msg, *i);
+    }
+
+    void decode(unsigned & i, const string & msg)
+    {
+      const DWORD size = decode_binary_data<DWORD>(i, msg, TEXT("mask size"));
+      if (size > max_cpus / 32)
+        throw error(TEXT("Invalid message received: mask too large"));
+      words.resize(size);
+      for (DWORD j = 0; j != size; ++j)
+        words[j] = decode_binary_data<DWORD>(i, msg, TEXT("mask"));
+    }
+};
+
+}
+
+#endif
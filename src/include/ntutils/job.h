@@ -0,0 +1,95 @@
+// Copyright 2005, Stephen Cleary
+// See the accompanying file "ntutils.chm" for licence information
+
+#ifndef NTUTILS_JOB_H
+#define NTUTILS_JOB_H
+
+#include "ntutils/basic.h"
+#include "ntutils/kernel32_dll.h"
+
+namespace ntutils {
+
+// Job object information, defined here since older headers don't have them
+// Classes for QueryInformationJobObject and SetInformationJobObject
+static const DWORD job_object_basic_accounting_information = 1;
+static const DWORD job_object_cpu_rate_control_information = 15;
+
+struct JOBOBJECT_BASIC_ACCOUNTING_INFORMATION_NT
+{
+  LARGE_INTEGER TotalUserTime;
+  LARGE_INTEGER TotalKernelTime;
+  LARGE_INTEGER ThisPeriodTotalUserTime;
+  LARGE_INTEGER ThisPeriodTotalKernelTime;
+  DWORD TotalPageFaultCount;
+  DWORD TotalProcesses;
+  DWORD ActiveProcesses;
+  DWORD TotalTerminatedProcesses;
+};
+
+// CPU rate control is only supported on Windows 8 and later
+// Value is a weight (1-9) or a rate (in hundredths of a percent), depending on ControlFlags
+struct JOBOBJECT_CPU_RATE_CONTROL_INFORMATION_NT
+{
+  DWORD ControlFlags;
+  DWORD Value;
+};
+
+static const DWORD job_object_cpu_rate_control_enable = 0x1;
+static const DWORD job_object_cpu_rate_control_weight_based = 0x2;
+static const DWORD job_object_cpu_rate_control_hard_cap = 0x4;
+
+static const DWORD min_cpu_weight = 1;
+static const DWORD max_cpu_weight = 9;
+static const DWORD max_cpu_rate = 10000;
+
+template <typename Owned = unowned>
+struct job: generic_null_handle_base<job<Owned> >
+{
+  typedef generic_null_handle_base<job<Owned> > base_type;
+  TBA_DEFINE_HANDLE_CLASS(job, HANDLE)
+
+  // Creates a named job object, or opens it if it already exists; returns true if it already existed
+  bool create_job(const LPCTSTR name)
+  {
+    BOOST_STATIC_ASSERT(Owned::value);
+    if (!singleton<kernel32_CreateJobObject>::instance()())
+      throw Win32_error(TEXT("CreateJobObject"), ERROR_CALL_NOT_IMPLEMENTED);
+    const HANDLE nhandle = singleton<kernel32_CreateJobObject>::instance()()(0, name);
+    if (nhandle == 0)
+      throw Win32_error(TEXT("CreateJobObject"));
+    const bool ret = (GetLastError() == ERROR_ALREADY_EXISTS);
+    this->Reset(nhandle);
+    return ret;
+  }
+
+  // The process handle needs PROCESS_SET_QUOTA and PROCESS_TERMINATE access
+  void assign_process(const HANDLE process) const
+  {
+    if (!singleton<kernel32_AssignProcessToJobObject>::instance()())
+      throw Win32_error(TEXT("AssignProcessToJobObject"), ERROR_CALL_NOT_IMPLEMENTED);
+    if (!singleton<kernel32_AssignProcessToJobObject>::instance()()(this->Handle(), process))
+      throw Win32_error(TEXT("AssignProcessToJobObject"));
+  }
+
+  template <typename T>
+  void set_information(const DWORD info_class, T & info) const
+  {
+    if (!singleton<kernel32_SetInformationJobObject>::instance()())
+      throw Win32_error(TEXT("SetInformationJobObject"), ERROR_CALL_NOT_IMPLEMENTED);
+    if (!singleton<kernel32_SetInformationJobObject>::instance()()(this->Handle(), info_class, &info, sizeof(info)))
+      throw Win32_error(TEXT("SetInformationJobObject"));
+  }
+
+  template <typename T>
+  void query_information(const DWORD info_class, T & info) const
+  {
+    if (!singleton<kernel32_QueryInformationJobObject>::instance()())
+      throw Win32_error(TEXT("QueryInformationJobObject"), ERROR_CALL_NOT_IMPLEMENTED);
+    if (!singleton<kernel32_QueryInformationJobObject>::instance()()(this->Handle(), info_class, &info, sizeof(info), 0))
+      throw Win32_error(TEXT("QueryInformationJobObject"));
+  }
+};
+
+}
+
+#endif
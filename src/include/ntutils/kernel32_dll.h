@@ -13,6 +13,27 @@ TBA_DEFINE_OPTIONAL_DLL(kernel32);
 typedef HANDLE (* __stdcall kernel32_OpenThreadProc)(DWORD, BOOL, DWORD);
 TBA_DEFINE_OPTIONAL_PROC(kernel32, OpenThread);
 
+// Job objects exist in 2K+
+#ifdef UNICODE
+typedef HANDLE (* __stdcall kernel32_CreateJobObjectWProc)(LPSECURITY_ATTRIBUTES, LPCWSTR);
+TBA_DEFINE_OPTIONAL_PROC(kernel32, CreateJobObjectW);
+typedef kernel32_CreateJobObjectW kernel32_CreateJobObject;
+#else
+typedef HANDLE (* __stdcall kernel32_CreateJobObjectAProc)(LPSECURITY_ATTRIBUTES, LPCSTR);
+TBA_DEFINE_OPTIONAL_PROC(kernel32, CreateJobObjectA);
+typedef kernel32_CreateJobObjectA kernel32_CreateJobObject;
+#endif
+
+typedef BOOL (* __stdcall kernel32_AssignProcessToJobObjectProc)(HANDLE, HANDLE);
+TBA_DEFINE_OPTIONAL_PROC(kernel32, AssignProcessToJobObject);
+
+// The information class is passed as a DWORD, since older headers don't define JOBOBJECTINFOCLASS
+typedef BOOL (* __stdcall kernel32_SetInformationJobObjectProc)(HANDLE, DWORD, LPVOID, DWORD);
+TBA_DEFINE_OPTIONAL_PROC(kernel32, SetInformationJobObject);
+
+typedef BOOL (* __stdcall kernel32_QueryInformationJobObjectProc)(HANDLE, DWORD, LPVOID, DWORD, LPDWORD);
+TBA_DEFINE_OPTIONAL_PROC(kernel32, QueryInformationJobObject);
+
 }
 
 #endif
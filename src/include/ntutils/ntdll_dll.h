@@ -26,6 +26,10 @@ struct SYSTEM_THREADS_NT4
   ULONG WaitReason;
 };
 
+// Values of SYSTEM_THREADS_NT4::State and SYSTEM_THREADS_NT4::WaitReason
+static const ULONG thread_state_waiting_nt4 = 5;
+static const ULONG wait_reason_suspended_nt4 = 5;
+
 struct SYSTEM_PROCESSES_NT4
 {
   ULONG NextEntryOffset;
@@ -53,9 +57,54 @@ struct SYSTEM_PROCESSES_NT4
   ULONG PagefileUsage;
   ULONG PeakPagefileUsage;
   ULONG unknown_; // Some claim this is "PrivatePageCount", others "CommitCharge" (in bytes)
-  SYSTEM_THREADS_NT4 Threads[1];
+
+  // The thread array follows, but not always right here; use system_process_threads()
+};
+
+// Windows 2000 and later insert these between SYSTEM_PROCESSES_NT4 and its thread array
+struct IO_COUNTERS_NT
+{
+  ULONGLONG ReadOperationCount;
+  ULONGLONG WriteOperationCount;
+  ULONGLONG OtherOperationCount;
+  ULONGLONG ReadTransferCount;
+  ULONGLONG WriteTransferCount;
+  ULONGLONG OtherTransferCount;
+};
+
+// True if process entries have I/O counters before their thread arrays (Windows 2000 and later)
+static inline bool system_processes_have_io_counters()
+{
+  return (LOBYTE(LOWORD(GetVersion())) >= 5);
+}
+
+// Returns the thread array of a process entry, which has ThreadCount elements
+static inline const SYSTEM_THREADS_NT4 * system_process_threads(const SYSTEM_PROCESSES_NT4 * const proc)
+{
+  const char * ret = (const char *) proc + sizeof(SYSTEM_PROCESSES_NT4);
+  if (system_processes_have_io_counters())
+    ret += sizeof(IO_COUNTERS_NT);
+  return (const SYSTEM_THREADS_NT4 *) ret;
+}
+
+// Returned by NtQueryInformationThread for thread_basic_information_nt
+struct THREAD_BASIC_INFORMATION_NT
+{
+  NTSTATUS ExitStatus;
+  PVOID TebBaseAddress;
+  CLIENT_ID ClientId;
+  ULONG_PTR AffinityMask;
+  LONG Priority;
+  LONG BasePriority;
 };
 
+// The THREADINFOCLASS value for THREAD_BASIC_INFORMATION_NT
+static const ULONG thread_basic_information_nt = 0;
+
+// The PROCESSINFOCLASS value for the I/O priority of a process (a ULONG); only
+//  supported on Vista and later
+static const ULONG process_io_priority_nt = 33;
+
 TBA_DEFINE_OPTIONAL_DLL(ntdll);
 
 typedef NTSTATUS (* __stdcall ntdll_NtOpenThreadProc)(PHANDLE, ACCESS_MASK, POBJECT_ATTRIBUTES, PCLIENT_ID);
@@ -64,6 +113,21 @@ TBA_DEFINE_OPTIONAL_PROC(ntdll, NtOpenThread);
 typedef NTSTATUS (* __stdcall ntdll_NtQuerySystemInformationProc)(SYSTEM_INFORMATION_CLASS, PVOID, ULONG, PULONG);
 TBA_DEFINE_OPTIONAL_PROC(ntdll, NtQuerySystemInformation);
 
+typedef NTSTATUS (* __stdcall ntdll_NtQueryInformationThreadProc)(HANDLE, ULONG, PVOID, ULONG, PULONG);
+TBA_DEFINE_OPTIONAL_PROC(ntdll, NtQueryInformationThread);
+
+typedef NTSTATUS (* __stdcall ntdll_NtQueryInformationProcessProc)(HANDLE, ULONG, PVOID, ULONG, PULONG);
+TBA_DEFINE_OPTIONAL_PROC(ntdll, NtQueryInformationProcess);
+
+typedef NTSTATUS (* __stdcall ntdll_NtSetInformationProcessProc)(HANDLE, ULONG, PVOID, ULONG);
+TBA_DEFINE_OPTIONAL_PROC(ntdll, NtSetInformationProcess);
+
+typedef NTSTATUS (* __stdcall ntdll_NtSuspendProcessProc)(HANDLE);
+TBA_DEFINE_OPTIONAL_PROC(ntdll, NtSuspendProcess);
+
+typedef NTSTATUS (* __stdcall ntdll_NtResumeProcessProc)(HANDLE);
+TBA_DEFINE_OPTIONAL_PROC(ntdll, NtResumeProcess);
+
 typedef ULONG (* __stdcall ntdll_RtlNtStatusToDosErrorProc)(NTSTATUS);
 TBA_DEFINE_OPTIONAL_PROC(ntdll, RtlNtStatusToDosError);
 
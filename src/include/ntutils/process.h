@@ -5,9 +5,103 @@
 #define NTUTILS_PROCESS_H
 
 #include "ntutils/basic.h"
+#include "ntutils/ntdll_dll.h"
+
+#ifndef PROCESS_SUSPEND_RESUME
+#define PROCESS_SUSPEND_RESUME 0x0800
+#endif
+
+#ifndef BELOW_NORMAL_PRIORITY_CLASS
+#define BELOW_NORMAL_PRIORITY_CLASS 0x4000
+#endif
+#ifndef ABOVE_NORMAL_PRIORITY_CLASS
+#define ABOVE_NORMAL_PRIORITY_CLASS 0x8000
+#endif
 
 namespace ntutils {
 
+// The Win32 priority classes, and the base priority each one gives the threads of a process
+// BELOW_NORMAL and ABOVE_NORMAL are not supported on NT 4.0.
+struct priority_class_info
+{
+  LPCTSTR name;
+  DWORD priority_class;
+  LONG base_priority;
+};
+
+static const priority_class_info priority_classes[] =
+{
+  { TEXT("IDLE"), IDLE_PRIORITY_CLASS, 4 },
+  { TEXT("BELOW_NORMAL"), BELOW_NORMAL_PRIORITY_CLASS, 6 },
+  { TEXT("NORMAL"), NORMAL_PRIORITY_CLASS, 8 },
+  { TEXT("ABOVE_NORMAL"), ABOVE_NORMAL_PRIORITY_CLASS, 10 },
+  { TEXT("HIGH"), HIGH_PRIORITY_CLASS, 13 },
+  { TEXT("REALTIME"), REALTIME_PRIORITY_CLASS, 24 }
+};
+
+static const unsigned num_priority_classes = sizeof(priority_classes) / sizeof(priority_classes[0]);
+
+// These return 0 if the priority class is not known; names are not case-sensitive
+static inline const priority_class_info * find_priority_class(const LPCTSTR name)
+{
+  for (unsigned i = 0; i != num_priority_classes; ++i)
+    if (!_tcsicmp(name, priority_classes[i].name))
+      return &priority_classes[i];
+  return 0;
+}
+static inline const priority_class_info * find_priority_class(const DWORD priority_class)
+{
+  for (unsigned i = 0; i != num_priority_classes; ++i)
+    if (priority_classes[i].priority_class == priority_class)
+      return &priority_classes[i];
+  return 0;
+}
+static inline const priority_class_info * find_priority_class_by_base(const LONG base_priority)
+{
+  for (unsigned i = 0; i != num_priority_classes; ++i)
+    if (priority_classes[i].base_priority == base_priority)
+      return &priority_classes[i];
+  return 0;
+}
+
+// The I/O priorities of a process; they are only supported on Vista and later
+// CRITICAL is reserved for the system, so it can be tested but not set.
+struct io_priority_info
+{
+  LPCTSTR name;
+  ULONG io_priority;
+};
+
+static const io_priority_info io_priorities[] =
+{
+  { TEXT("VERY_LOW"), 0 },
+  { TEXT("LOW"), 1 },
+  { TEXT("NORMAL"), 2 },
+  { TEXT("HIGH"), 3 },
+  { TEXT("CRITICAL"), 4 }
+};
+
+static const unsigned num_io_priorities = sizeof(io_priorities) / sizeof(io_priorities[0]);
+
+// The highest I/O priority that may be set (HIGH)
+static const ULONG max_settable_io_priority = 3;
+
+// These return 0 if the I/O priority is not known; names are not case-sensitive
+static inline const io_priority_info * find_io_priority(const LPCTSTR name)
+{
+  for (unsigned i = 0; i != num_io_priorities; ++i)
+    if (!_tcsicmp(name, io_priorities[i].name))
+      return &io_priorities[i];
+  return 0;
+}
+static inline const io_priority_info * find_io_priority(const ULONG io_priority)
+{
+  for (unsigned i = 0; i != num_io_priorities; ++i)
+    if (io_priorities[i].io_priority == io_priority)
+      return &io_priorities[i];
+  return 0;
+}
+
 template <typename Owned = unowned>
 struct process: generic_null_handle_base<process<Owned> >
 {
@@ -43,6 +137,73 @@ struct process: generic_null_handle_base<process<Owned> >
     if (!SetPriorityClass(level))
       throw Win32_error(TEXT("SetPriorityClass"));
   }
+
+  BOOL GetProcessTimes(FILETIME & creation, FILETIME & exit, FILETIME & kernel, FILETIME & user) const
+  { return ::GetProcessTimes(this->Handle(), &creation, &exit, &kernel, &user); }
+  void get_process_times(FILETIME & creation, FILETIME & exit, FILETIME & kernel, FILETIME & user) const
+  {
+    if (!GetProcessTimes(creation, exit, kernel, user))
+      throw Win32_error(TEXT("GetProcessTimes"));
+  }
+
+  BOOL GetProcessAffinityMask(DWORD_PTR & process_mask, DWORD_PTR & system_mask) const
+  { return ::GetProcessAffinityMask(this->Handle(), &process_mask, &system_mask); }
+  DWORD_PTR get_process_affinity_mask() const
+  {
+    DWORD_PTR process_mask, system_mask;
+    if (!GetProcessAffinityMask(process_mask, system_mask))
+      throw Win32_error(TEXT("GetProcessAffinityMask"));
+    return process_mask;
+  }
+
+  BOOL SetProcessAffinityMask(const DWORD_PTR mask) const { return ::SetProcessAffinityMask(this->Handle(), mask); }
+  void set_process_affinity_mask(const DWORD_PTR mask) const
+  {
+    if (!SetProcessAffinityMask(mask))
+      throw Win32_error(TEXT("SetProcessAffinityMask"));
+  }
+
+  // The I/O priority is only available through the NT API, on Vista and later
+  // The process handle needs PROCESS_QUERY_INFORMATION or PROCESS_SET_INFORMATION access
+  ULONG get_io_priority() const
+  {
+    if (!singleton<ntdll_NtQueryInformationProcess>::instance()())
+      throw Win32_error(TEXT("NtQueryInformationProcess"), ERROR_CALL_NOT_IMPLEMENTED);
+    ULONG ret;
+    const NTSTATUS err = singleton<ntdll_NtQueryInformationProcess>::instance()()(this->Handle(),
+        process_io_priority_nt, &ret, sizeof(ret), 0);
+    if (!NT_SUCCESS(err))
+      throw Win32_error(TEXT("NtQueryInformationProcess"), PortableRtlNtStatusToDosError(err));
+    return ret;
+  }
+  void set_io_priority(ULONG io_priority) const
+  {
+    if (!singleton<ntdll_NtSetInformationProcess>::instance()())
+      throw Win32_error(TEXT("NtSetInformationProcess"), ERROR_CALL_NOT_IMPLEMENTED);
+    const NTSTATUS err = singleton<ntdll_NtSetInformationProcess>::instance()()(this->Handle(),
+        process_io_priority_nt, &io_priority, sizeof(io_priority));
+    if (!NT_SUCCESS(err))
+      throw Win32_error(TEXT("NtSetInformationProcess"), PortableRtlNtStatusToDosError(err));
+  }
+
+  // Suspends or resumes all threads in the process with a single call
+  // These are only available on XP and later; the process handle needs PROCESS_SUSPEND_RESUME access
+  void suspend_process() const
+  {
+    if (!singleton<ntdll_NtSuspendProcess>::instance()())
+      throw Win32_error(TEXT("NtSuspendProcess"), ERROR_CALL_NOT_IMPLEMENTED);
+    const NTSTATUS err = singleton<ntdll_NtSuspendProcess>::instance()()(this->Handle());
+    if (!NT_SUCCESS(err))
+      throw Win32_error(TEXT("NtSuspendProcess"), PortableRtlNtStatusToDosError(err));
+  }
+  void resume_process() const
+  {
+    if (!singleton<ntdll_NtResumeProcess>::instance()())
+      throw Win32_error(TEXT("NtResumeProcess"), ERROR_CALL_NOT_IMPLEMENTED);
+    const NTSTATUS err = singleton<ntdll_NtResumeProcess>::instance()()(this->Handle());
+    if (!NT_SUCCESS(err))
+      throw Win32_error(TEXT("NtResumeProcess"), PortableRtlNtStatusToDosError(err));
+  }
 };
 
 }
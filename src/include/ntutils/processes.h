@@ -4,95 +4,321 @@
 #ifndef NTUTILS_PROCESSES_H
 #define NTUTILS_PROCESSES_H
 
+#include <algorithm>
 #include <map>
+#include <vector>
 
 #include "ntutils/console.h"
+#include "ntutils/process.h"
 #include "ntutils/toolhelp.h"
 #include "ntutils/shlwapi_dll.h"
 #include "ntutils/message.h"
 
 namespace ntutils {
 
-// Returns all processes matching the prefix 'name'
-inline static std::map<DWORD, string> find_process(const string & name, const bool exact_match)
+// Case-insensitive match of a string against a pattern that may contain the wildcards
+//  '*' (any number of characters) and '?' (any one character)
+static inline bool wildcard_match(const char_t * pattern, const char_t * const pattern_end,
+    const char_t * str, const char_t * const str_end)
 {
-  std::map<DWORD, string> ret;
-  tool_help_snapshot<owned> snapshot;
-  snapshot.create(TH32CS_SNAPPROCESS);
-  for (tool_help_process_iterator i = snapshot.processes_begin(); i != snapshot.processes_end(); ++i)
-  {
-    if (i->th32ProcessID == 0)
-      continue;
+  // Where to resume if the characters after the last '*' stop matching
+  const char_t * star_pattern = 0;
+  const char_t * star_str = 0;
 
-    if (exact_match)
+  while (str != str_end)
+  {
+    if (pattern != pattern_end && *pattern == TEXT('*'))
     {
-      // This test only allows exact matches
-      if (!_tcsicmp(i->szExeFile, name.c_str()))
-        ret[i->th32ProcessID] = i->szExeFile;
-      else
-      {
-        // Also allow exact matches on the process base name
-        PROCESSENTRY32 proc = *i;
-        PortablePathRemoveExtension(proc.szExeFile);
-        if (!_tcsicmp(proc.szExeFile, name.c_str()))
-          ret[i->th32ProcessID] = i->szExeFile;
-      }
+      star_pattern = ++pattern;
+      star_str = str;
+    }
+    else if (pattern != pattern_end && (*pattern == TEXT('?') || _totlower(*pattern) == _totlower(*str)))
+    {
+      ++pattern;
+      ++str;
+    }
+    else if (star_pattern != 0)
+    {
+      // Let the last '*' swallow one more character, and try again from there
+      pattern = star_pattern;
+      str = ++star_str;
     }
     else
+      return false;
+  }
+
+  while (pattern != pattern_end && *pattern == TEXT('*'))
+    ++pattern;
+  return (pattern == pattern_end);
+}
+
+// Matches process names against a name given by the user, without copying the process names
+// An exact match allows the whole process name or the process name without its extension;
+//  otherwise, the name given by the user is a prefix of the process name
+// The name given by the user may contain the wildcards '*' and '?'
+class process_name_matcher
+{
+  private:
+    string name;
+    bool exact_match;
+    bool wildcard;
+
+  public:
+    process_name_matcher(const string & nname, const bool nexact_match)
+    :name(nname), exact_match(nexact_match), wildcard(nname.find_first_of(TEXT("*?")) != string::npos)
     {
+      // A prefix match is the same as a pattern match with a trailing '*'
+      if (wildcard && !exact_match)
+        name += TEXT('*');
+    }
+
+    bool operator()(const LPCTSTR process_name) const
+    {
+      if (wildcard)
+      {
+        const char_t * const name_end = name.c_str() + name.length();
+        const LPCTSTR process_name_end = process_name + _tcslen(process_name);
+        if (wildcard_match(name.c_str(), name_end, process_name, process_name_end))
+          return true;
+        return (exact_match && wildcard_match(name.c_str(), name_end, process_name,
+            PortablePathFindExtension(process_name)));
+      }
+
       // This test allows, e.g., "proc.exe" to only match processes called "proc.exe"
       //  while also allowing "proc" to match processes called "proc.exe" or "proc.com"
-      if (!_tcsnicmp(i->szExeFile, name.c_str(), name.length()))
-        ret[i->th32ProcessID] = i->szExeFile;
+      if (!exact_match)
+        return !_tcsnicmp(process_name, name.c_str(), name.length());
+
+      // Both exact tests compare exactly name.length() characters, so anything of a
+      //  different length is rejected before comparing any characters
+      const unsigned length = _tcslen(process_name);
+      if (length < name.length())
+        return false;
+      if (length == name.length())
+        return !_tcsnicmp(process_name, name.c_str(), length);
+
+      // Also allow exact matches on the process base name
+      const unsigned base_length = PortablePathFindExtension(process_name) - process_name;
+      if (base_length != name.length())
+        return false;
+      return !_tcsnicmp(process_name, name.c_str(), base_length);
+    }
+};
+
+// A set of processes, sorted by process id
+// The process names are kept together in a single buffer, so building the set costs a few
+//  amortized allocations rather than one or two per process
+class process_set
+{
+  public:
+    struct entry
+    {
+      DWORD pid;
+
+      // Offset of the (null-terminated) process name in the name buffer
+      unsigned name_offset;
+
+      // The base priority of the process's threads, as of the snapshot (0 if not known)
+      LONG base_priority;
+
+      bool operator<(const entry & other) const { return (pid < other.pid); }
+    };
+
+    typedef std::vector<entry>::const_iterator const_iterator;
+
+  private:
+    std::vector<entry> entries;
+    string names;
+
+    struct pid_less
+    {
+      bool operator()(const entry & a, const DWORD b) const { return (a.pid < b); }
+    };
+
+  public:
+    // Adds a process; call sort() when done adding
+    void insert(const DWORD pid, const LPCTSTR name, const LONG base_priority = 0)
+    {
+      entry e;
+      e.pid = pid;
+      e.name_offset = names.size();
+      e.base_priority = base_priority;
+      entries.push_back(e);
+      names.append(name, _tcslen(name) + 1);
+    }
+
+    void sort() { std::sort(entries.begin(), entries.end()); }
+
+    // Keeps the allocated memory, so a set that is refilled over and over doesn't reallocate
+    void clear()
+    {
+      entries.clear();
+      names.erase();
+    }
+
+    void erase(const DWORD pid)
+    {
+      const std::vector<entry>::iterator i = std::lower_bound(entries.begin(), entries.end(), pid, pid_less());
+      if (i != entries.end() && i->pid == pid)
+        entries.erase(i);
+    }
+
+    bool empty() const { return entries.empty(); }
+    unsigned size() const { return entries.size(); }
+
+    const_iterator begin() const { return entries.begin(); }
+    const_iterator end() const { return entries.end(); }
+    const entry & operator[](const unsigned index) const { return entries[index]; }
+
+    LPCTSTR name(const entry & e) const { return names.c_str() + e.name_offset; }
+};
+
+// The children of each process, from one snapshot
+// A process's parent id is not cleared when the parent exits, so the id may since have been
+//  reused by an unrelated process; callers that care must check creation times.
+class process_tree
+{
+  private:
+    std::map<DWORD, process_set> children;
+    process_set no_children;
+
+  public:
+    template <typename Owned>
+    void assign(const tool_help_snapshot<Owned> & snapshot)
+    {
+      children.clear();
+      for (tool_help_process_iterator i = snapshot.processes_begin(); i != snapshot.processes_end(); ++i)
+      {
+        if (i->th32ProcessID == 0 || i->th32ProcessID == i->th32ParentProcessID)
+          continue;
+        children[i->th32ParentProcessID].insert(i->th32ProcessID, i->szExeFile, i->pcPriClassBase);
+      }
+      for (std::map<DWORD, process_set>::iterator i = children.begin(); i != children.end(); ++i)
+        i->second.sort();
+    }
+
+    // Returns an empty set if the process has no children (or doesn't exist)
+    const process_set & process_children(const DWORD pid) const
+    {
+      const std::map<DWORD, process_set>::const_iterator i = children.find(pid);
+      if (i == children.end())
+        return no_children;
+      return i->second;
     }
+};
+
+// Returns all processes matching the prefix 'name'
+inline static process_set find_process(const string & name, const bool exact_match)
+{
+  process_set ret;
+  const process_name_matcher matches(name, exact_match);
+  tool_help_snapshot<owned> snapshot;
+  snapshot.create(TH32CS_SNAPPROCESS);
+  for (tool_help_process_iterator i = snapshot.processes_begin(); i != snapshot.processes_end(); ++i)
+  {
+    if (i->th32ProcessID == 0)
+      continue;
+
+    if (matches(i->szExeFile))
+      ret.insert(i->th32ProcessID, i->szExeFile, i->pcPriClassBase);
   }
+  ret.sort();
   return ret;
 }
 
 // Returns all processes matching the process id
-inline static std::map<DWORD, string> find_process(const DWORD pid)
+inline static process_set find_process(const DWORD pid)
 {
-  std::map<DWORD, string> ret;
+  process_set ret;
   tool_help_snapshot<owned> snapshot;
   snapshot.create(TH32CS_SNAPPROCESS);
   for (tool_help_process_iterator i = snapshot.processes_begin(); i != snapshot.processes_end(); ++i)
   {
     if (i->th32ProcessID == pid)
     {
-      ret[i->th32ProcessID] = i->szExeFile;
+      ret.insert(i->th32ProcessID, i->szExeFile, i->pcPriClassBase);
       break;
     }
   }
+  ret.sort();
   return ret;
 }
 
 // Returns all processes
-inline static std::map<DWORD, string> find_process()
+inline static process_set find_process()
 {
-  std::map<DWORD, string> ret;
+  process_set ret;
   tool_help_snapshot<owned> snapshot;
   snapshot.create(TH32CS_SNAPPROCESS);
   for (tool_help_process_iterator i = snapshot.processes_begin(); i != snapshot.processes_end(); ++i)
   {
     if (i->th32ProcessID != 0)
-      ret[i->th32ProcessID] = i->szExeFile;
+      ret.insert(i->th32ProcessID, i->szExeFile, i->pcPriClassBase);
   }
+  ret.sort();
   return ret;
 }
 
 // Handles common command-line options and logic for selecting a set of processes
+// Any number of process ids and names may be given; a process is selected if it matches any of them
+// Filters may further restrict the selection, using other information from the snapshot
 class process_selector
 {
   private:
     // Selecting by process id
-    DWORD pid;
+    std::vector<DWORD> pids;
 
     // Selecting by process name
-    string name;
+    std::vector<string> names;
     bool exact_match;
 
+    // Filters (applied to all processes if there are no ids or names, which is only allowed
+    //  for actions that don't change anything; see validate_options)
+    // min_threads is inclusive: a process with exactly that many threads passes
+    bool filter_parent;
+    DWORD parent_pid;
+    DWORD min_threads;
+    LONG below_base_priority;
+
+    bool select_all() const { return (pids.empty() && names.empty()); }
+    bool filtered() const { return (filter_parent || min_threads != 0 || below_base_priority != 0); }
+
+    bool passes_filters(const PROCESSENTRY32 & proc) const
+    {
+      if (filter_parent && proc.th32ParentProcessID != parent_pid)
+        return false;
+      if (proc.cntThreads < min_threads)
+        return false;
+      if (below_base_priority != 0 && proc.pcPriClassBase >= below_base_priority)
+        return false;
+      return true;
+    }
+
+    static DWORD parse_dword_option(const option_parser & options, const_str_ptr option_name)
+    {
+      char_t * test;
+      const DWORD ret = _tcstoul(options.argument, &test, 0);
+      if (*test != 0)
+        throw option_error(string(TEXT("Invalid argument '")) + options.argument + TEXT("' for option --") + option_name);
+      return ret;
+    }
+
+    // Accepts a base priority, or the name of a priority class (standing for the base
+    //  priority of that class)
+    static LONG parse_base_priority_option(const option_parser & options)
+    {
+      const priority_class_info * const info = find_priority_class(options.argument);
+      if (info)
+        return info->base_priority;
+      const DWORD ret = parse_dword_option(options, TEXT("below"));
+      if (ret == 0 || ret > 31)
+        throw option_error(string(TEXT("Invalid argument '")) + options.argument + TEXT("' for option --below"));
+      return ret;
+    }
+
   public:
-    process_selector():pid(0), exact_match(true) { }
+    process_selector()
+    :exact_match(true), filter_parent(false), parent_pid(0), min_threads(0), below_base_priority(0) { }
 
     bool handle_option(const option_parser & options)
     {
@@ -101,100 +327,227 @@ class process_selector
         case TEXT('i'):
         {
           char_t * test;
-          pid = _tcstoul(options.argument, &test, 0);
+          const DWORD pid = _tcstoul(options.argument, &test, 0);
           if (pid == 0 || *test != 0)
             throw option_error(string(TEXT("Invalid argument '")) + options.argument + TEXT("' for option --pid"));
+          pids.push_back(pid);
           return true;
         }
         case TEXT('n'):
-          name = options.argument;
+          names.push_back(options.argument);
           return true;
         case TEXT('s'):
           exact_match = false;
           return true;
+        case TEXT('P'):
+          filter_parent = true;
+          parent_pid = parse_dword_option(options, TEXT("parent"));
+          return true;
+        case TEXT('T'):
+          min_threads = parse_dword_option(options, TEXT("threads"));
+          return true;
+        case TEXT('B'):
+          below_base_priority = parse_base_priority_option(options);
+          return true;
         default:
           return false;
       }
     }
 
+    // Returns true if any process ids, names, or filters were given
+    bool has_targets() const { return (!select_all() || filtered()); }
+
+    // Unless allow_all is set (e.g., for a test), a process id or name is required; filters
+    //  only narrow the selection, so they can't select targets on their own
     void validate_options(const bool allow_all) const
     {
-      if (pid == 0 && name.empty() && !allow_all)
-        throw option_error(TEXT("Neither process id nor process name specified"));
-      if (pid != 0 && !name.empty())
-        throw option_error(TEXT("Both process id and process name specified"));
+      if (!select_all() || allow_all)
+        return;
+      if (filtered())
+        throw option_error(TEXT("Filters cannot be used without a process id or process name, except when testing"));
+      throw option_error(TEXT("Neither process id nor process name specified"));
     }
 
-    std::map<DWORD, string> select_processes() const
+    // Tests a single process against all the ids, names and filters
+    // This is for callers that only test the occasional process (e.g., one that has just
+    //  started); select_processes is faster for a whole snapshot
+    bool selects(const PROCESSENTRY32 & proc) const
     {
-      if (name.empty() && pid == 0)
-        return find_process();
-      else if (!name.empty())
-        return find_process(name, exact_match);
-      else
-        return find_process(pid);
+      if (proc.th32ProcessID == 0 || !passes_filters(proc))
+        return false;
+      if (select_all())
+        return true;
+      if (std::find(pids.begin(), pids.end(), proc.th32ProcessID) != pids.end())
+        return true;
+      for (std::vector<string>::const_iterator i = names.begin(); i != names.end(); ++i)
+        if (process_name_matcher(*i, exact_match)(proc.szExeFile))
+          return true;
+      return false;
+    }
+
+    // Takes a single snapshot, testing each process against all the ids, names and filters
+    process_set select_processes() const
+    {
+      tool_help_snapshot<owned> snapshot;
+      snapshot.create(TH32CS_SNAPPROCESS);
+      return select_processes(snapshot);
+    }
+
+    // Selects from an existing snapshot, which must include TH32CS_SNAPPROCESS; this allows
+    //  the caller to use the same snapshot for other purposes
+    template <typename Owned>
+    process_set select_processes(const tool_help_snapshot<Owned> & snapshot) const
+    {
+      std::vector<DWORD> sorted_pids(pids);
+      std::sort(sorted_pids.begin(), sorted_pids.end());
+
+      std::vector<process_name_matcher> matchers;
+      matchers.reserve(names.size());
+      for (std::vector<string>::const_iterator i = names.begin(); i != names.end(); ++i)
+        matchers.push_back(process_name_matcher(*i, exact_match));
+
+      process_set ret;
+      for (tool_help_process_iterator i = snapshot.processes_begin(); i != snapshot.processes_end(); ++i)
+      {
+        if (i->th32ProcessID == 0)
+          continue;
+
+        if (!passes_filters(*i))
+          continue;
+
+        if (select_all())
+        {
+          ret.insert(i->th32ProcessID, i->szExeFile, i->pcPriClassBase);
+          continue;
+        }
+
+        if (std::binary_search(sorted_pids.begin(), sorted_pids.end(), i->th32ProcessID))
+        {
+          ret.insert(i->th32ProcessID, i->szExeFile, i->pcPriClassBase);
+          continue;
+        }
+
+        for (std::vector<process_name_matcher>::const_iterator j = matchers.begin(); j != matchers.end(); ++j)
+        {
+          if ((*j)(i->szExeFile))
+          {
+            ret.insert(i->th32ProcessID, i->szExeFile, i->pcPriClassBase);
+            break;
+          }
+        }
+      }
+      ret.sort();
+      return ret;
     }
 
     void encode_target(string & msg) const
     {
-      if (pid != 0)
+      for (std::vector<DWORD>::const_iterator i = pids.begin(); i != pids.end(); ++i)
       {
         msg += TEXT('i');
-        encode_binary_data<DWORD>(msg, pid);
+        encode_binary_data<DWORD>(msg, *i);
       }
-      else if (!name.empty())
+      for (std::vector<string>::const_iterator i = names.begin(); i != names.end(); ++i)
       {
         if (exact_match)
           msg += TEXT('n');
         else
           msg += TEXT('s');
-        encode_string(msg, name);
+        encode_string(msg, *i);
+      }
+      if (filter_parent)
+      {
+        msg += TEXT('p');
+        encode_binary_data<DWORD>(msg, parent_pid);
+      }
+      if (min_threads != 0)
+      {
+        msg += TEXT('c');
+        encode_binary_data<DWORD>(msg, min_threads);
+      }
+      if (below_base_priority != 0)
+      {
+        msg += TEXT('b');
+        encode_binary_data<LONG>(msg, below_base_priority);
       }
     }
 
+    // Decodes targets up to the end of the message
     void decode_target(unsigned & i, const string & msg)
     {
       if (msg.size() == i)
         throw error(TEXT("Invalid message received: no target"));
 
-      switch (msg[i++])
+      while (msg.size() != i)
       {
-        case TEXT('i'):
-        {
-          pid = decode_binary_data<DWORD>(i, msg, TEXT("pid target"));
-          break;
-        }
-        case TEXT('s'):
-          exact_match = false;
-          // (fallthrough)
-        case TEXT('n'):
+        switch (msg[i++])
         {
-          name = decode_string(i, msg, TEXT("name target"));
-          break;
+          case TEXT('i'):
+          {
+            pids.push_back(decode_binary_data<DWORD>(i, msg, TEXT("pid target")));
+            break;
+          }
+          case TEXT('s'):
+            exact_match = false;
+            // (fallthrough)
+          case TEXT('n'):
+          {
+            names.push_back(decode_string(i, msg, TEXT("name target")));
+            break;
+          }
+          case TEXT('p'):
+          {
+            filter_parent = true;
+            parent_pid = decode_binary_data<DWORD>(i, msg, TEXT("parent filter"));
+            break;
+          }
+          case TEXT('c'):
+          {
+            min_threads = decode_binary_data<DWORD>(i, msg, TEXT("thread count filter"));
+            break;
+          }
+          case TEXT('b'):
+          {
+            below_base_priority = decode_binary_data<LONG>(i, msg, TEXT("base priority filter"));
+            break;
+          }
+          default:
+            throw error(TEXT("Invalid message received: unknown target"));
         }
-        default:
-          throw error(TEXT("Invalid message received: unknown target"));
       }
     }
 
-    string xml_attribute() const
+    // Returns the attributes of one info node per target
+    std::vector<string> xml_attributes() const
     {
-      if (name.empty() && pid == 0)
-        return TEXT("target_process='all'");
-      else if (!name.empty())
-        return TEXT("target_process_name=") + make_xml_attribute_value(name) + TEXT(" exact_match='") + to_string(exact_match) + TEXT('\'');
-      else
-        return TEXT("target_process_id='") + to_string(pid) + TEXT('\'');
+      std::vector<string> ret;
+      if (select_all())
+        ret.push_back(TEXT("target_process='all'"));
+      for (std::vector<DWORD>::const_iterator i = pids.begin(); i != pids.end(); ++i)
+        ret.push_back(TEXT("target_process_id='") + to_string(*i) + TEXT('\''));
+      for (std::vector<string>::const_iterator i = names.begin(); i != names.end(); ++i)
+        ret.push_back(TEXT("target_process_name=") + make_xml_attribute_value(*i) + TEXT(" exact_match='") + to_string(exact_match) + TEXT('\''));
+      if (filter_parent)
+        ret.push_back(TEXT("filter_parent_process_id='") + to_string(parent_pid) + TEXT('\''));
+      if (min_threads != 0)
+        ret.push_back(TEXT("filter_min_threads='") + to_string(min_threads) + TEXT('\''));
+      if (below_base_priority != 0)
+        ret.push_back(TEXT("filter_below_base_priority='") + to_string(below_base_priority) + TEXT('\''));
+      return ret;
     }
 
     void validate_process_list(bool empty) const
     {
       if (!empty)
         return;
-      if (pid != 0)
-        throw error(TEXT("Could not find process ") + to_string(pid));
+      if (filtered())
+        throw error(TEXT("Could not find any processes matching the filters"));
+      else if (pids.size() == 1 && names.empty())
+        throw error(TEXT("Could not find process ") + to_string(pids.front()));
+      else if (pids.empty() && names.size() == 1)
+        throw error(TEXT("Could not find process '") + names.front() + TEXT('\''));
       else
-        throw error(TEXT("Could not find process '") + name + TEXT('\''));
+        throw error(TEXT("Could not find any of the specified processes"));
     }
 };
 
@@ -91,6 +91,15 @@ struct program_results
       buffer += TEXT("<info ") + attributes + TEXT(" />");
   }
 
+  // Information that is shown in normal output as well (e.g., statistics that were asked for)
+  void report_info(const string & msg, const string & attributes)
+  {
+    if (xml)
+      buffer += TEXT("<info ") + attributes + TEXT(" />");
+    else
+      buffer += get_context_string() + msg + TEXT('\n');
+  }
+
   // Called at the end of the program
   int return_code()
   {
@@ -196,11 +205,42 @@ struct computer_context: result_context
 
 struct process_context: result_context
 {
-  process_context(const string & name, const DWORD id)
-  :result_context(name + TEXT(" (") + to_string(id) + TEXT(")"),
+  process_context(const_str name, const DWORD id)
+  :result_context(name.as_string() + TEXT(" (") + to_string(id) + TEXT(")"),
        TEXT("process_name=") + make_xml_attribute_value(name) + TEXT(" process_id='") + to_string(id) + TEXT('\'')) { }
 };
 
+struct thread_context: result_context
+{
+  explicit thread_context(const DWORD id)
+  :result_context(TEXT("thread ") + to_string(id), TEXT("thread_id='") + to_string(id) + TEXT('\'')) { }
+};
+
+// A result or error produced on a worker thread
+// program_results is not thread-safe, so the outcome is kept until the main thread
+//  reports it in the right context.
+struct deferred_result
+{
+  string value, attributes;
+  boost::shared_ptr<error> failure;
+
+  void set_result(const string & nvalue, const string & nattributes = string())
+  {
+    value = nvalue;
+    attributes = nattributes;
+  }
+
+  void set_error(const error & e) { failure.reset(new error(e)); }
+
+  void report() const
+  {
+    if (failure)
+      results.report_error(*failure);
+    else
+      results.report_result(value, attributes);
+  }
+};
+
 }
 
 #endif
@@ -6,18 +6,24 @@
 
 namespace ntutils {
 
-static inline void PortablePathRemoveExtension(const LPTSTR str)
+// Returns a pointer to the extension (including the '.'), or to the terminating null
+//  if there is no extension
+static inline LPCTSTR PortablePathFindExtension(const LPCTSTR str)
 {
-  const LPTSTR str_end = str + _tcslen(str);
-  for (LPTSTR i = str_end - 1; i >= str; --i)
+  const LPCTSTR str_end = str + _tcslen(str);
+  for (LPCTSTR i = str_end - 1; i >= str; --i)
   {
     if (*i == TEXT('/') || *i == TEXT('\\'))
-      return;
-    if (*i != TEXT('.'))
-      continue;
-    *i = 0;
-    return;
+      return str_end;
+    if (*i == TEXT('.'))
+      return i;
   }
+  return str_end;
+}
+
+static inline void PortablePathRemoveExtension(const LPTSTR str)
+{
+  *(str + (PortablePathFindExtension(str) - str)) = 0;
 }
 
 }
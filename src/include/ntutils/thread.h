@@ -77,6 +77,39 @@ struct thread: generic_null_handle_base<thread<Owned> >
       throw Win32_error(TEXT("ResumeThread"));
     return ret;
   }
+
+  // Returns the previous affinity mask
+  DWORD_PTR SetThreadAffinityMask(const DWORD_PTR mask) const { return ::SetThreadAffinityMask(this->Handle(), mask); }
+  DWORD_PTR set_thread_affinity_mask(const DWORD_PTR mask) const
+  {
+    const DWORD_PTR ret = SetThreadAffinityMask(mask);
+    if (ret == 0)
+      throw Win32_error(TEXT("SetThreadAffinityMask"));
+    return ret;
+  }
+
+  // The thread handle needs THREAD_QUERY_INFORMATION access
+  THREAD_BASIC_INFORMATION_NT query_basic_information() const
+  {
+    if (!singleton<ntdll_NtQueryInformationThread>::instance()())
+      throw Win32_error(TEXT("NtQueryInformationThread"), ERROR_CALL_NOT_IMPLEMENTED);
+    THREAD_BASIC_INFORMATION_NT info;
+    const NTSTATUS err = singleton<ntdll_NtQueryInformationThread>::instance()()(this->Handle(),
+        thread_basic_information_nt, &info, sizeof(info), 0);
+    if (!NT_SUCCESS(err))
+      throw Win32_error(TEXT("NtQueryInformationThread"), PortableRtlNtStatusToDosError(err));
+    return info;
+  }
+
+  // Win32 has no way to read a thread's affinity mask without changing it, so this uses the
+  //  NT API; the thread handle needs THREAD_QUERY_INFORMATION access
+  DWORD_PTR get_thread_affinity_mask() const
+  { return query_basic_information().AffinityMask; }
+
+  // Returns the id of the process that the thread belongs to (GetProcessIdOfThread is only
+  //  available on Vista and later); the thread handle needs THREAD_QUERY_INFORMATION access
+  DWORD get_process_id() const
+  { return (DWORD) query_basic_information().ClientId.UniqueProcess; }
 };
 
 }
@@ -26,23 +26,165 @@ TBA_DEFINE_OPTIONAL_PROC(kernel32, Thread32First);
 typedef BOOL (* __stdcall kernel32_Thread32NextProc)(HANDLE, LPTHREADENTRY32);
 TBA_DEFINE_OPTIONAL_PROC(kernel32, Thread32Next);
 
-// Note: this is not an exact duplication of the Win32 Toolhelp API:
-//  . The returned handle may not be closeable using CloseHandle;
-//    close with PortableCloseToolhelp32Snapshot instead
-//  . The only supported flags are TH32CS_SNAPPROCESS and TH32CS_SNAPTHREAD
-//  . dwSize of the structures is ignored, and only the reliable fields are set
-static inline HANDLE PortableCreateToolhelp32Snapshot(const DWORD flags, const DWORD process_id)
+// Buffers for NtQuerySystemInformation process snapshots
+// The size of the last successful snapshot is remembered (plus some headroom), and the
+//  most recently released buffer is kept for the next snapshot, so repeated snapshots
+//  usually need neither a retry nor an allocation.
+// Snapshots may be taken from several worker threads at once, so all access is locked.
+class nt4_snapshot_buffers: boost::noncopyable
 {
-  if (singleton<kernel32_CreateToolhelp32Snapshot>::instance()())
-    return singleton<kernel32_CreateToolhelp32Snapshot>::instance()()(flags, process_id);
+  public:
+    // What the snapshots have cost so far in this run
+    struct totals
+    {
+      unsigned snapshots;
+      unsigned retries;      // STATUS_INFO_LENGTH_MISMATCH retries
+      unsigned long bytes_allocated;
 
-  // Check to make sure no unsupported flags are passed
-  if ((flags & ~TH32CS_SNAPPROCESS & ~TH32CS_SNAPTHREAD) != 0)
+      totals(): snapshots(0), retries(0), bytes_allocated(0) { }
+    };
+
+  private:
+    critical_section lock;
+
+    // A released buffer waiting to be reused (0 if none)
+    char * spare;
+    unsigned spare_size;
+
+    // The size to start with for the next snapshot
+    unsigned next_size;
+
+    totals costs;
+
+  public:
+    nt4_snapshot_buffers()
+    :spare(0), spare_size(0), next_size(64 * sizeof(SYSTEM_PROCESSES_NT4)) { }
+
+    ~nt4_snapshot_buffers() { delete [] spare; }
+
+    totals get_totals()
+    {
+      critical_section_lock guard(lock);
+      return costs;
+    }
+
+    // Fills a buffer with a snapshot of all processes and threads; on success, the caller
+    //  owns the buffer and hands it back with release()
+    // May throw std::bad_alloc
+    NTSTATUS query(char * & buffer, unsigned & size)
+    {
+      critical_section_lock guard(lock);
+      ++costs.snapshots;
+
+      if (spare != 0 && spare_size >= next_size)
+      {
+        buffer = spare;
+        size = spare_size;
+        spare = 0;
+      }
+      else
+      {
+        delete [] spare;
+        spare = 0;
+        size = next_size;
+        buffer = new char[size];
+        costs.bytes_allocated += size;
+      }
+
+      NTSTATUS err;
+      ULONG used = 0;
+      while ((err = singleton<ntdll_NtQuerySystemInformation>::instance()()(
+          SystemProcessesAndThreadsInformation, buffer, size, &used)) == STATUS_INFO_LENGTH_MISMATCH)
+      {
+        ++costs.retries;
+        delete [] buffer;
+        buffer = 0;
+        size *= 2;
+        buffer = new char[size];
+        costs.bytes_allocated += size;
+      }
+
+      if (!NT_SUCCESS(err))
+      {
+        release(buffer, size);
+        return err;
+      }
+
+      // NT 4.0 does not always report the length used; if it doesn't, the whole buffer counts
+      if (used == 0 || used > size)
+        used = size;
+      next_size = used + used / 4;
+
+      return err;
+    }
+
+    // Takes back a buffer returned from query(), keeping the larger of it and the current spare
+    void release(char * const buffer, const unsigned size)
+    {
+      critical_section_lock guard(lock);
+      if (spare != 0 && spare_size >= size)
+      {
+        delete [] buffer;
+        return;
+      }
+      delete [] spare;
+      spare = buffer;
+      spare_size = size;
+    }
+};
+
+// The fallback snapshot handle: the NtQuerySystemInformation buffer, with cursors
+//  for process and thread iteration
+// The two iterations are independent, and each step is constant-time
+struct nt4_snapshot: boost::noncopyable
+{
+  char * buffer;
+  unsigned size;
+
+  // The current process of process iteration
+  const SYSTEM_PROCESSES_NT4 * process;
+
+  // The current thread of thread iteration (thread index 'thread' within 'thread_process')
+  const SYSTEM_PROCESSES_NT4 * thread_process;
+  unsigned thread;
+
+  nt4_snapshot(char * const nbuffer, const unsigned nsize)
+  :buffer(nbuffer), size(nsize), process(0), thread_process(0), thread(0) { }
+
+  ~nt4_snapshot() { singleton<nt4_snapshot_buffers>::instance().release(buffer, size); }
+
+  const SYSTEM_PROCESSES_NT4 * first_process() const
+  { return (const SYSTEM_PROCESSES_NT4 *) buffer; }
+
+  // Returns 0 if there are no more processes
+  static const SYSTEM_PROCESSES_NT4 * next_process(const SYSTEM_PROCESSES_NT4 * const proc)
   {
-    SetLastError(ERROR_CALL_NOT_IMPLEMENTED);
-    return 0;
+    if (proc->NextEntryOffset == 0)
+      return 0;
+    return (const SYSTEM_PROCESSES_NT4 *) ((const char *) proc + proc->NextEntryOffset);
   }
 
+  // Moves the thread cursor forward to a valid thread (skipping processes without threads);
+  //  returns false if there are no more threads
+  bool skip_to_thread()
+  {
+    while (thread == thread_process->ThreadCount)
+    {
+      thread_process = next_process(thread_process);
+      if (thread_process == 0)
+        return false;
+      thread = 0;
+    }
+    return true;
+  }
+};
+
+// Takes a snapshot of all processes and threads with NtQuerySystemInformation
+// This is the fallback for PortableCreateToolhelp32Snapshot, but it may also be used directly
+//  (even where the Toolhelp API exists) for information that Toolhelp does not report
+// Returns 0 (and sets the last error) on failure; the caller must delete the snapshot
+static inline nt4_snapshot * create_nt4_snapshot()
+{
   if (!singleton<ntdll_NtQuerySystemInformation>::instance()())
   {
     SetLastError(ERROR_CALL_NOT_IMPLEMENTED);
@@ -51,34 +193,50 @@ static inline HANDLE PortableCreateToolhelp32Snapshot(const DWORD flags, const D
 
   try
   {
-    unsigned size = 64 * sizeof(SYSTEM_PROCESSES_NT4);
-    char * ret = new char[size];
-
-    NTSTATUS err;
-    while ((err = singleton<ntdll_NtQuerySystemInformation>::instance()()(
-        SystemProcessesAndThreadsInformation, ret, size, 0)) == STATUS_INFO_LENGTH_MISMATCH)
-    {
-      size *= 2;
-      delete [] ret;
-      ret = new char[size];
-    }
-
+    char * ret;
+    unsigned size;
+    const NTSTATUS err = singleton<nt4_snapshot_buffers>::instance().query(ret, size);
     if (!NT_SUCCESS(err))
     {
       SetLastError(PortableRtlNtStatusToDosError(err));
       return 0;
     }
 
-    return (HANDLE) ret;
+    try
+    {
+      return new nt4_snapshot(ret, size);
+    }
+    catch (const std::bad_alloc &)
+    {
+      singleton<nt4_snapshot_buffers>::instance().release(ret, size);
+      throw;
+    }
   }
   catch (const std::bad_alloc &)
   {
     SetLastError(ERROR_NOT_ENOUGH_MEMORY);
     return 0;
   }
+}
+
+// Note: this is not an exact duplication of the Win32 Toolhelp API:
+//  . The returned handle may not be closeable using CloseHandle;
+//    close with PortableCloseToolhelp32Snapshot instead
+//  . The only supported flags are TH32CS_SNAPPROCESS and TH32CS_SNAPTHREAD
+//  . dwSize of the structures is ignored, and only the reliable fields are set
+static inline HANDLE PortableCreateToolhelp32Snapshot(const DWORD flags, const DWORD process_id)
+{
+  if (singleton<kernel32_CreateToolhelp32Snapshot>::instance()())
+    return singleton<kernel32_CreateToolhelp32Snapshot>::instance()()(flags, process_id);
+
+  // Check to make sure no unsupported flags are passed
+  if ((flags & ~TH32CS_SNAPPROCESS & ~TH32CS_SNAPTHREAD) != 0)
+  {
+    SetLastError(ERROR_CALL_NOT_IMPLEMENTED);
+    return 0;
+  }
 
-  SetLastError(ERROR_CALL_NOT_IMPLEMENTED);
-  return 0;
+  return (HANDLE) create_nt4_snapshot();
 }
 
 static inline BOOL PortableCloseToolhelp32Snapshot(const HANDLE handle)
@@ -86,7 +244,7 @@ static inline BOOL PortableCloseToolhelp32Snapshot(const HANDLE handle)
   if (singleton<kernel32_CreateToolhelp32Snapshot>::instance()())
     return CloseHandle(handle);
 
-  delete [] (char *) handle;
+  delete (nt4_snapshot *) handle;
   return TRUE;
 }
 
@@ -96,24 +254,32 @@ static inline BOOL PortableProcess32_copy_data(const LPPROCESSENTRY32 data, cons
   data->cntThreads = proc->ThreadCount;
   data->th32ParentProcessID = proc->InheritedFromProcessId;
   data->pcPriClassBase = proc->BasePriority;
+  // ProcessName.Length is in bytes, and the name is not always null-terminated
+  const int length = proc->ProcessName.Length / sizeof(WCHAR);
 #ifdef UNICODE
-  const int n = std::min<int>(MAX_PATH - 1, proc->ProcessName.Length);
+  const int n = std::min<int>(MAX_PATH - 1, length);
   wcsncpy(data->szExeFile, proc->ProcessName.Buffer, n);
   data->szExeFile[n] = 0;
 #else
   if (proc->ProcessName.Buffer == 0)
     strcpy(data->szExeFile, "Idle");
-  else if (!WideCharToMultiByte(CP_ACP, 0, proc->ProcessName.Buffer, proc->ProcessName.Length, data->szExeFile, MAX_PATH, 0, 0))
-    return FALSE;
+  else
+  {
+    const int n = WideCharToMultiByte(CP_ACP, 0, proc->ProcessName.Buffer, length, data->szExeFile, MAX_PATH - 1, 0, 0);
+    if (n == 0)
+      return FALSE;
+    data->szExeFile[n] = 0;
+  }
 #endif
   return TRUE;
 }
 
 static inline void PortableThread32_copy_data(const LPTHREADENTRY32 data, const SYSTEM_PROCESSES_NT4 * const proc, const unsigned thread)
 {
-  data->th32ThreadID = (DWORD) proc->Threads[thread].ClientId.UniqueThread;
+  const SYSTEM_THREADS_NT4 & info = system_process_threads(proc)[thread];
+  data->th32ThreadID = (DWORD) info.ClientId.UniqueThread;
   data->th32OwnerProcessID = proc->ProcessId;
-  data->tpBasePri = proc->Threads[thread].BasePriority;
+  data->tpBasePri = info.BasePriority;
 }
 
 static inline BOOL PortableProcess32First(const HANDLE handle, const LPPROCESSENTRY32 data)
@@ -121,7 +287,9 @@ static inline BOOL PortableProcess32First(const HANDLE handle, const LPPROCESSEN
   if (singleton<kernel32_Process32First>::instance()())
     return singleton<kernel32_Process32First>::instance()()(handle, data);
 
-  return PortableProcess32_copy_data(data, (const SYSTEM_PROCESSES_NT4 *) handle);
+  nt4_snapshot * const snapshot = (nt4_snapshot *) handle;
+  snapshot->process = snapshot->first_process();
+  return PortableProcess32_copy_data(data, snapshot->process);
 }
 
 static inline BOOL PortableProcess32Next(const HANDLE handle, const LPPROCESSENTRY32 data)
@@ -129,27 +297,22 @@ static inline BOOL PortableProcess32Next(const HANDLE handle, const LPPROCESSENT
   if (singleton<kernel32_Process32Next>::instance()())
     return singleton<kernel32_Process32Next>::instance()()(handle, data);
 
-  // Find our current spot in our snapshot
-  const SYSTEM_PROCESSES_NT4 * proc;
-  for (proc = (const SYSTEM_PROCESSES_NT4 *) handle; proc != 0;
-      proc = ((proc->NextEntryOffset == 0) ? 0 : (const SYSTEM_PROCESSES_NT4 *) ((const char *) proc + proc->NextEntryOffset)))
-    if (proc->ProcessId == data->th32ProcessID)
-      break;
-  if (proc == 0)
+  nt4_snapshot * const snapshot = (nt4_snapshot *) handle;
+  if (snapshot->process == 0)
   {
     SetLastError(ERROR_INVALID_DATA);
     return FALSE;
   }
 
   // Increment (if possible) and return
-
-  if (proc->NextEntryOffset == 0)
+  const SYSTEM_PROCESSES_NT4 * const proc = nt4_snapshot::next_process(snapshot->process);
+  if (proc == 0)
   {
     SetLastError(ERROR_NO_MORE_FILES);
     return FALSE;
   }
 
-  proc = (const SYSTEM_PROCESSES_NT4 *) ((const char *) proc + proc->NextEntryOffset);
+  snapshot->process = proc;
   return PortableProcess32_copy_data(data, proc);
 }
 
@@ -158,7 +321,16 @@ static inline BOOL PortableThread32First(const HANDLE handle, const LPTHREADENTR
   if (singleton<kernel32_Thread32First>::instance()())
     return singleton<kernel32_Thread32First>::instance()()(handle, data);
 
-  PortableThread32_copy_data(data, (const SYSTEM_PROCESSES_NT4 *) handle, 0);
+  nt4_snapshot * const snapshot = (nt4_snapshot *) handle;
+  snapshot->thread_process = snapshot->first_process();
+  snapshot->thread = 0;
+  if (!snapshot->skip_to_thread())
+  {
+    SetLastError(ERROR_NO_MORE_FILES);
+    return FALSE;
+  }
+
+  PortableThread32_copy_data(data, snapshot->thread_process, snapshot->thread);
   return TRUE;
 }
 
@@ -167,48 +339,23 @@ static inline BOOL PortableThread32Next(const HANDLE handle, const LPTHREADENTRY
   if (singleton<kernel32_Thread32Next>::instance()())
     return singleton<kernel32_Thread32Next>::instance()()(handle, data);
 
-  // Find the current process
-  const SYSTEM_PROCESSES_NT4 * proc;
-  for (proc = (const SYSTEM_PROCESSES_NT4 *) handle; proc != 0;
-      proc = ((proc->NextEntryOffset == 0) ? 0 : (const SYSTEM_PROCESSES_NT4 *) ((const char *) proc + proc->NextEntryOffset)))
-    if (proc->ProcessId == data->th32OwnerProcessID)
-      break;
-  if (proc == 0)
+  nt4_snapshot * const snapshot = (nt4_snapshot *) handle;
+  if (snapshot->thread_process == 0)
   {
     SetLastError(ERROR_INVALID_DATA);
     return FALSE;
   }
 
-  // Find the current thread
-  unsigned thread;
-  for (thread = 0; thread != proc->ThreadCount; ++thread)
-    if ((DWORD) proc->Threads[thread].ClientId.UniqueThread == data->th32ThreadID)
-      break;
-  if (thread == proc->ThreadCount)
-  {
-    SetLastError(ERROR_INVALID_DATA);
-    return FALSE;
-  }
-
-  // Increment (if possible) and return
-
-  ++thread;
-  if (thread != proc->ThreadCount)
-  {
-    PortableThread32_copy_data(data, proc, thread);
-    return TRUE;
-  }
-
-  // Reached the end of the thread list for that process, so start with next process
-
-  if (proc->NextEntryOffset == 0)
+  // Increment (if possible) and return; this moves on to the next process when we
+  //  reach the end of the thread list for the current one
+  ++snapshot->thread;
+  if (!snapshot->skip_to_thread())
   {
     SetLastError(ERROR_NO_MORE_FILES);
     return FALSE;
   }
 
-  proc = (const SYSTEM_PROCESSES_NT4 *) ((const char *) proc + proc->NextEntryOffset);
-  PortableThread32_copy_data(data, proc, 0);
+  PortableThread32_copy_data(data, snapshot->thread_process, snapshot->thread);
   return TRUE;
 }
 
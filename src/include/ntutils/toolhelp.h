@@ -4,6 +4,9 @@
 #ifndef NTUTILS_TOOLHELP_H
 #define NTUTILS_TOOLHELP_H
 
+#include <map>
+#include <vector>
+
 #include <boost/iterator/iterator_facade.hpp>
 
 #include "ntutils/tlhelp32_dll.h"
@@ -116,6 +119,48 @@ struct tool_help_snapshot: null_handle_base<tool_help_snapshot<Owned> >
   }
 };
 
+// Buckets the threads in a snapshot by their owning process, so that operations on one
+//  process only have to examine the threads of that process
+class tool_help_thread_index
+{
+  private:
+    std::map<DWORD, std::vector<DWORD> > threads;
+
+    // Returned for processes that aren't in the index (a member rather than a local static,
+    //  since local statics aren't initialized safely when the index is used from worker threads)
+    std::vector<DWORD> no_threads;
+
+  public:
+    // (Re-)creates the index from a new snapshot of all threads in the system
+    void create()
+    {
+      tool_help_snapshot<owned> snapshot;
+      snapshot.create(TH32CS_SNAPTHREAD);
+      assign(snapshot);
+    }
+
+    // (Re-)creates the index from an existing snapshot, which must include TH32CS_SNAPTHREAD
+    template <typename Owned>
+    void assign(const tool_help_snapshot<Owned> & snapshot)
+    {
+      // Keep the per-process vectors around, so their memory is reused by later snapshots
+      for (std::map<DWORD, std::vector<DWORD> >::iterator i = threads.begin(); i != threads.end(); ++i)
+        i->second.clear();
+
+      for (tool_help_thread_iterator i = snapshot.threads_begin(); i != snapshot.threads_end(); ++i)
+        threads[i->th32OwnerProcessID].push_back(i->th32ThreadID);
+    }
+
+    // Returns the thread ids of a process as of the last snapshot
+    const std::vector<DWORD> & process_threads(const DWORD process_id) const
+    {
+      const std::map<DWORD, std::vector<DWORD> >::const_iterator i = threads.find(process_id);
+      if (i == threads.end())
+        return no_threads;
+      return i->second;
+    }
+};
+
 }
 
 #endif
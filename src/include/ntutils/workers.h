@@ -0,0 +1,125 @@
+// Copyright 2005, Stephen Cleary
+// See the accompanying file "ntutils.chm" for licence information
+
+#ifndef NTUTILS_WORKERS_H
+#define NTUTILS_WORKERS_H
+
+#include <process.h>
+#include <vector>
+
+#include "ntutils/basic.h"
+#include "ntutils/console.h"
+#include "ntutils/message.h"
+#include "ntutils/token.h"
+
+namespace ntutils {
+
+// The most worker threads that may be asked for (WaitForMultipleObjects can't wait for more)
+static const unsigned max_jobs = MAXIMUM_WAIT_OBJECTS;
+
+// Parses the argument of a --jobs option
+static inline unsigned parse_jobs_option(const option_parser & options)
+{
+  char_t * test;
+  const DWORD ret = _tcstoul(options.argument, &test, 0);
+  if (*test != 0 || ret == 0 || ret > max_jobs)
+    throw option_error(string(TEXT("Invalid argument '")) + options.argument + TEXT("' for option --jobs (must be from 1 to ") +
+        to_string(max_jobs) + TEXT(")"));
+  return ret;
+}
+
+// Reads a job count from a remote message
+static inline unsigned decode_jobs(unsigned & i, const string & msg)
+{
+  const DWORD ret = decode_binary_data<DWORD>(i, msg, TEXT("job count"));
+  if (ret == 0 || ret > max_jobs)
+    throw error(TEXT("Invalid message received: invalid job count"));
+  return ret;
+}
+
+// The shared state of one parallel_for call
+// Items are handed out one at a time from a shared counter, so a worker that finishes
+//  early just takes the next item instead of waiting for the others.
+template <typename Function>
+class parallel_for_state: boost::noncopyable
+{
+  private:
+    Function & function;
+    const LONG count;
+    LONG next_item;
+    LONG next_worker;
+
+  public:
+    // The calling thread's impersonation token (invalid if it is not impersonating)
+    token<owned> impersonation;
+
+    parallel_for_state(Function & nfunction, const unsigned ncount)
+    :function(nfunction), count(ncount), next_item(0), next_worker(0) { }
+
+    void run(const unsigned worker)
+    {
+      while (true)
+      {
+        const LONG item = InterlockedIncrement(&next_item) - 1;
+        if (item >= count)
+          return;
+        function(item, worker);
+      }
+    }
+
+    static unsigned __stdcall thread_proc(void * const param)
+    {
+      parallel_for_state & state = *static_cast<parallel_for_state *>(param);
+      const unsigned worker = InterlockedIncrement(&state.next_worker);
+
+      // A worker must act with the same rights as the calling thread; if it can't,
+      //  it leaves all the items to the other threads
+      if (state.impersonation.Valid() && !SetThreadToken(0, state.impersonation.Handle()))
+        return 0;
+
+      state.run(worker);
+      return 0;
+    }
+};
+
+// Calls function(item, worker) for each item in [0, count), using up to "jobs" threads
+// The calling thread is worker 0, and the other threads are numbered from 1, so the
+//  function can keep per-worker state in an array of "jobs" elements.
+// The function must not throw; the items are finished when this function returns.
+// If a worker thread can't be started, the items are shared among fewer threads.
+template <typename Function>
+void parallel_for(const unsigned count, unsigned jobs, Function & function)
+{
+  parallel_for_state<Function> state(function, count);
+  if (jobs > count)
+    jobs = count;
+  if (jobs > max_jobs)
+    jobs = max_jobs;
+
+  std::vector<HANDLE> threads;
+  if (jobs > 1)
+  {
+    threads.reserve(jobs - 1);
+    state.impersonation.OpenThreadToken(GetCurrentThread(), TOKEN_IMPERSONATE);
+    for (unsigned i = 1; i != jobs; ++i)
+    {
+      const HANDLE thread = (HANDLE) _beginthreadex(0, 0, &parallel_for_state<Function>::thread_proc, &state, 0, 0);
+      if (thread == 0)
+        break;
+      threads.push_back(thread);
+    }
+  }
+
+  state.run(0);
+
+  if (!threads.empty())
+  {
+    WaitForMultipleObjects(threads.size(), &threads[0], TRUE, INFINITE);
+    for (std::vector<HANDLE>::const_iterator i = threads.begin(); i != threads.end(); ++i)
+      CloseHandle(*i);
+  }
+}
+
+}
+
+#endif
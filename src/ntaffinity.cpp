@@ -0,0 +1,246 @@
+// Copyright 2005, Stephen Cleary
+// See the accompanying file "ntutils.chm" for licence information
+
+#include <windows.h>
+
+#include <boost/array.hpp>
+
+#include "ntaffinity.inc"
+#include "ntutils/remote_framework.h"
+
+// Larger than the other programs, since --each-thread gives a result for every thread
+static const DWORD max_response_size = 65536;
+
+static const string name = TEXT("ntaffinity");
+
+program_results results;
+
+struct server: server_framework<server>
+{
+  static inline const string & name() { return ::name; }
+  static inline void handle_message(unsigned & i, const string & msg)
+  {
+    // Message format:
+    //  Action (1 char): m (set mask, followed by the CPU mask) or t(est)
+    //    The CPU mask is a DWORD count of words (up to 32, for 1024 CPUs), followed by
+    //    that many DWORDs; bit n of word w is CPU 32 * w + n
+    //  Options (optional):
+    //    e, to act on each thread
+    //    j, followed by DWORD of the number of processes to act on at once
+    //  Targets (optional for Test action), repeated up to the end of the message:
+    //    i, followed by DWORD of pid
+    //    n, followed by length-prefixed string of name
+    //    s, followed by length-prefixed string of name (substring match)
+    //    p, followed by DWORD of parent pid (filter)
+    //    c, followed by DWORD of minimum thread count (filter)
+    //    b, followed by LONG of base priority limit (filter)
+
+    ntaffinity_options options;
+    process_selector selector;
+
+    if (msg.size() == i)
+      throw error(TEXT("Invalid message received: no action"));
+
+    switch (msg[i++])
+    {
+      case TEXT('m'):
+        options.mask.decode(i, msg);
+        if (options.mask.empty())
+          throw error(TEXT("Invalid message received: empty mask"));
+        break;
+      case TEXT('t'): options.test = true; break;
+      default: throw error(TEXT("Invalid message received: unknown action"));
+    }
+
+    for (bool more_options = true; more_options && msg.size() != i; )
+    {
+      switch (msg[i])
+      {
+        case TEXT('e'): ++i; options.each_thread = true; break;
+        case TEXT('j'): ++i; options.jobs = decode_jobs(i, msg); break;
+        default: more_options = false;
+      }
+    }
+
+    if (msg.size() == i)
+    {
+      if (!options.test)
+        throw error(TEXT("Invalid message received: no target"));
+    }
+    else
+      selector.decode_target(i, msg);
+
+    if (msg.size() != i)
+      throw error(TEXT("Invalid message received: extra data"));
+
+    ntaffinity(false, selector, options);
+  }
+};
+
+struct client_def: client_framework<client_def>
+{
+  static inline const string & name() { return server::name(); }
+};
+
+int usage()
+{
+  tcerr(TEXT("Usage: ntaffinity [options]\n"));
+  tcerr(TEXT("Options:\n"));
+  tcerr(TEXT("  -h [ --help ]           : Display this information\n"));
+  tcerr(TEXT("  -x [ --xml ]            : Output XML\n"));
+  tcerr(TEXT("  -i [ --pid ] arg        : Specify process id\n"));
+  tcerr(TEXT("  -n [ --name ] arg       : Specify process name\n"));
+  tcerr(TEXT("  -s [ --substr ]         :   Process name is a substring match\n"));
+  tcerr(TEXT("  -P [ --parent ] arg     : Only select children of this process id\n"));
+  tcerr(TEXT("  -T [ --threads ] arg    : Only select processes with at least 'arg' threads\n"));
+  tcerr(TEXT("  -B [ --below ] arg      : Only select processes with a base priority below 'arg'\n"));
+  tcerr(TEXT("                          'arg' may be a numerical value or a level name\n"));
+  tcerr(TEXT("  -m [ --mask ] arg       : Set CPU affinity of process(es)\n"));
+  tcerr(TEXT("                          'arg' may be a list of CPUs (e.g., 0-3,8) or a\n"));
+  tcerr(TEXT("                          hexadecimal mask (e.g., 0xF0)\n"));
+  tcerr(TEXT("  -t [ --test ]           : Test CPU affinity of process(es)\n"));
+  tcerr(TEXT("  -e [ --each-thread ]    : Act on each thread of the process(es)\n"));
+  tcerr(TEXT("  -j [ --jobs ] arg       : Act on up to 'arg' processes at once (default 1)\n"));
+  tcerr(TEXT("  -c [ --computer ] arg   : Execute on remote computer\n"));
+  tcerr(TEXT("  -u [ --username ] arg   :   Username for remote computer\n"));
+  tcerr(TEXT("  -p [ --password ] [arg] :   Password for remote computer\n"));
+  return 1;
+}
+
+int command_line_main(int argc, char_t * argv[])
+{
+  boost::array<option_def, 15> option_defs = { {
+      { TEXT('h'), TEXT("help") },
+      { TEXT('x'), TEXT("xml") },
+      { TEXT('i'), TEXT("pid"), option_def::required_argument },
+      { TEXT('n'), TEXT("name"), option_def::required_argument },
+      { TEXT('s'), TEXT("substr") },
+      { TEXT('P'), TEXT("parent"), option_def::required_argument },
+      { TEXT('T'), TEXT("threads"), option_def::required_argument },
+      { TEXT('B'), TEXT("below"), option_def::required_argument },
+      { TEXT('m'), TEXT("mask"), option_def::required_argument },
+      { TEXT('t'), TEXT("test") },
+      { TEXT('e'), TEXT("each-thread") },
+      { TEXT('j'), TEXT("jobs"), option_def::required_argument },
+      { TEXT('c'), TEXT("computer"), option_def::required_argument },
+      { TEXT('u'), TEXT("username"), option_def::required_argument },
+      { TEXT('p'), TEXT("password"), option_def::optional_argument }
+  } };
+
+  try
+  {
+    option_parser options(argc, argv + 1, option_defs.begin(), option_defs.end());
+
+    ntaffinity_options affinity_options;
+    process_selector selector;
+    client_def client;
+    while (options.getopt())
+    {
+      if (!options.option)
+        throw option_error(string(TEXT("Missing option for argument '")) + options.argument + TEXT("'"));
+
+      switch (options.option->short_option)
+      {
+        case TEXT('h'):
+          return usage();
+        case TEXT('m'):
+          if (!affinity_options.mask.parse(options.argument) || affinity_options.mask.empty())
+            throw option_error(string(TEXT("Invalid argument '")) + options.argument + TEXT("' for option --mask"));
+          break;
+        case TEXT('t'):
+          affinity_options.test = true;
+          break;
+        case TEXT('e'):
+          affinity_options.each_thread = true;
+          break;
+        case TEXT('j'):
+          affinity_options.jobs = parse_jobs_option(options);
+          break;
+        default:
+          if (selector.handle_option(options))
+            break;
+          if (client.handle_option(options))
+            break;
+          if (results.handle_option(options))
+            break;
+      }
+    }
+
+    if (!affinity_options.test && affinity_options.mask.empty())
+      throw option_error(TEXT("Neither --mask nor --test specified"));
+    selector.validate_options(affinity_options.test);
+
+    if (results.xml)
+    {
+      results.buffer += TEXT('<') + name + TEXT(" version='1.0'>");
+      if (affinity_options.test)
+        results.report_info(TEXT("action='test'"));
+      else
+        results.report_info(TEXT("action='set mask' value=") + make_xml_attribute_value(affinity_options.mask.list()) +
+            TEXT(" mask='") + affinity_options.mask.hex() + TEXT('\''));
+      if (affinity_options.each_thread)
+        results.report_info(TEXT("scope='thread'"));
+      const std::vector<string> targets = selector.xml_attributes();
+      for (std::vector<string>::const_iterator i = targets.begin(); i != targets.end(); ++i)
+        results.report_info(*i);
+    }
+
+    // Handle local requests
+    if (!client.is_remote())
+      ntaffinity(true, selector, affinity_options);
+    else
+    {
+      // Construct the message to be sent
+      string msg;
+      if (affinity_options.test)
+        msg += TEXT('t');
+      else
+      {
+        msg += TEXT('m');
+        affinity_options.mask.encode(msg);
+      }
+      if (affinity_options.each_thread)
+        msg += TEXT('e');
+      if (affinity_options.jobs != 1)
+      {
+        msg += TEXT('j');
+        encode_binary_data<DWORD>(msg, affinity_options.jobs);
+      }
+
+      selector.encode_target(msg);
+
+      // Handle remote requests
+      client.start(msg, max_response_size);
+    }
+
+    if (results.xml)
+      results.buffer += TEXT("</") + name + TEXT(">\n");
+
+    tcout(results.buffer);
+    return results.return_code();
+  }
+  catch (const option_error & e)
+  {
+    tcerr(e.twhat() + TEXT('\n'));
+    return usage();
+  }
+  catch (const std::exception & e)
+  {
+    tcerr("Error: " + ANSI_string(e.what()) + '\n');
+    return 1;
+  }
+
+  return 0;
+}
+
+int main(int argc, char * argv[])
+{
+  // We can act as though invoked from the command line if StartServiceCtrlDispatcher fails,
+  //  and that would work; however, StartServiceCtrlDispatcher may delay for several seconds.
+  // So instead, we pass a secret parameter "service" when running as a service
+
+  if (argc == 2 && !_tcscmp(argv[1], TEXT("service")))
+    return server::start();
+  else
+    return command_line_main(argc, argv);
+}
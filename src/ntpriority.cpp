@@ -20,14 +20,19 @@ struct server: server_framework<server>
   static inline void handle_message(unsigned & i, const string & msg)
   {
     // Message format:
-    //  Action (1 char): l (set level, followed by DWORD of level) or t(est)
-    //  Target (optional for Test action):
+    //  Action (1 char): l (set level, followed by DWORD of level), t(est),
+    //    o (set I/O priority, followed by DWORD of I/O priority), or q (test I/O priority)
+    //  Options (optional):
+    //    j, followed by DWORD of the number of processes to act on at once
+    //  Targets (optional for Test action), repeated up to the end of the message:
     //    i, followed by DWORD of pid
     //    n, followed by length-prefixed string of name
     //    s, followed by length-prefixed string of name (substring match)
+    //    p, followed by DWORD of parent pid (filter)
+    //    c, followed by DWORD of minimum thread count (filter)
+    //    b, followed by LONG of base priority limit (filter)
 
-    DWORD level;
-    bool test = false;
+    ntpriority_options options;
     process_selector selector;
 
     if (msg.size() == i)
@@ -35,14 +40,30 @@ struct server: server_framework<server>
 
     switch (msg[i++])
     {
-      case TEXT('l'): level = decode_binary_data<DWORD>(i, msg, TEXT("level")); break;
-      case TEXT('t'): test = true; break;
+      case TEXT('l'): options.level = decode_binary_data<DWORD>(i, msg, TEXT("level")); break;
+      case TEXT('t'): options.test = true; break;
+      case TEXT('o'):
+        options.io = true;
+        options.level = decode_binary_data<DWORD>(i, msg, TEXT("I/O priority"));
+        if (options.level > max_settable_io_priority)
+          throw error(TEXT("Invalid message received: I/O priority cannot be set"));
+        break;
+      case TEXT('q'): options.io = true; options.test = true; break;
       default: throw error(TEXT("Invalid message received: unknown action"));
     }
 
+    for (bool more_options = true; more_options && msg.size() != i; )
+    {
+      switch (msg[i])
+      {
+        case TEXT('j'): ++i; options.jobs = decode_jobs(i, msg); break;
+        default: more_options = false;
+      }
+    }
+
     if (msg.size() == i)
     {
-      if (!test)
+      if (!options.test)
         throw error(TEXT("Invalid message received: no target"));
     }
     else
@@ -51,7 +72,7 @@ struct server: server_framework<server>
     if (msg.size() != i)
       throw error(TEXT("Invalid message received: extra data"));
 
-    ntpriority(false, selector, level, test);
+    ntpriority(false, selector, options);
   }
 };
 
@@ -69,10 +90,25 @@ int usage()
   tcerr(TEXT("  -i [ --pid ] arg        : Specify process id\n"));
   tcerr(TEXT("  -n [ --name ] arg       : Specify process name\n"));
   tcerr(TEXT("  -s [ --substr ]         :   Process name is a substring match\n"));
+  tcerr(TEXT("  -P [ --parent ] arg     : Only select children of this process id\n"));
+  tcerr(TEXT("  -T [ --threads ] arg    : Only select processes with at least 'arg' threads\n"));
+  tcerr(TEXT("  -B [ --below ] arg      : Only select processes with a base priority below 'arg'\n"));
+  tcerr(TEXT("                          'arg' may be a numerical value or a level name\n"));
   tcerr(TEXT("  -l [ --level ] arg      : Set priority level of process(es)\n"));
   tcerr(TEXT("                          'arg' may be a numerical value or IDLE, BELOW_NORMAL,\n"));
   tcerr(TEXT("                          NORMAL, ABOVE_NORMAL, HIGH, or REALTIME\n"));
   tcerr(TEXT("  -t [ --test ]           : Test priority level of process(es)\n"));
+  tcerr(TEXT("  -I [ --io ]             : Set or test I/O priority instead of priority level\n"));
+  tcerr(TEXT("                          --level may then be a numerical value or VERY_LOW,\n"));
+  tcerr(TEXT("                          LOW, NORMAL, or HIGH\n"));
+  tcerr(TEXT("  -j [ --jobs ] arg       : Act on up to 'arg' processes at once (default 1)\n"));
+  tcerr(TEXT("  -w [ --watch ] arg      : Keep setting the priority level of new processes,\n"));
+  tcerr(TEXT("                          using the rules in file 'arg'\n"));
+  tcerr(TEXT("  -a [ --auto ] arg       : Keep lowering the priority level of processes that use\n"));
+  tcerr(TEXT("                          more than 'arg' percent of all CPUs to --level\n"));
+  tcerr(TEXT("                          (default IDLE), restoring it when they calm down\n"));
+  tcerr(TEXT("  -e [ --every ] arg      :   Look for new processes (default 100ms) or sample\n"));
+  tcerr(TEXT("                          CPU use (default 1s) every 'arg'\n"));
   tcerr(TEXT("  -c [ --computer ] arg   : Execute on remote computer\n"));
   tcerr(TEXT("  -u [ --username ] arg   :   Username for remote computer\n"));
   tcerr(TEXT("  -p [ --password ] [arg] :   Password for remote computer\n"));
@@ -81,14 +117,22 @@ int usage()
 
 int command_line_main(int argc, char_t * argv[])
 {
-  boost::array<option_def, 10> option_defs = { {
+  boost::array<option_def, 18> option_defs = { {
       { TEXT('h'), TEXT("help") },
       { TEXT('x'), TEXT("xml") },
       { TEXT('i'), TEXT("pid"), option_def::required_argument },
       { TEXT('n'), TEXT("name"), option_def::required_argument },
       { TEXT('s'), TEXT("substr") },
+      { TEXT('P'), TEXT("parent"), option_def::required_argument },
+      { TEXT('T'), TEXT("threads"), option_def::required_argument },
+      { TEXT('B'), TEXT("below"), option_def::required_argument },
       { TEXT('l'), TEXT("level"), option_def::required_argument },
       { TEXT('t'), TEXT("test") },
+      { TEXT('I'), TEXT("io") },
+      { TEXT('j'), TEXT("jobs"), option_def::required_argument },
+      { TEXT('w'), TEXT("watch"), option_def::required_argument },
+      { TEXT('a'), TEXT("auto"), option_def::required_argument },
+      { TEXT('e'), TEXT("every"), option_def::required_argument },
       { TEXT('c'), TEXT("computer"), option_def::required_argument },
       { TEXT('u'), TEXT("username"), option_def::required_argument },
       { TEXT('p'), TEXT("password"), option_def::optional_argument }
@@ -98,8 +142,8 @@ int command_line_main(int argc, char_t * argv[])
   {
     option_parser options(argc, argv + 1, option_defs.begin(), option_defs.end());
 
-    DWORD level;
-    bool test = false;
+    ntpriority_options priority_options;
+    const char_t * level_argument = 0;
     process_selector selector;
     client_def client;
     while (options.getopt())
@@ -112,30 +156,31 @@ int command_line_main(int argc, char_t * argv[])
         case TEXT('h'):
           return usage();
         case TEXT('l'):
+          // Parsed below, since its meaning depends on --io
+          level_argument = options.argument;
+          break;
+        case TEXT('t'):
+          priority_options.test = true;
+          break;
+        case TEXT('I'):
+          priority_options.io = true;
+          break;
+        case TEXT('j'):
+          priority_options.jobs = parse_jobs_option(options);
+          break;
+        case TEXT('w'):
+          priority_options.rule_file = options.argument;
+          break;
+        case TEXT('a'):
         {
           char_t * test;
-          level = _tcstoul(options.argument, &test, 0);
-          if (*test != 0)
-          {
-            if (!_tcsicmp(options.argument, TEXT("ABOVE_NORMAL")))
-              level = ABOVE_NORMAL_PRIORITY_CLASS;
-            else if (!_tcsicmp(options.argument, TEXT("BELOW_NORMAL")))
-              level = BELOW_NORMAL_PRIORITY_CLASS;
-            else if (!_tcsicmp(options.argument, TEXT("HIGH")))
-              level = HIGH_PRIORITY_CLASS;
-            else if (!_tcsicmp(options.argument, TEXT("IDLE")))
-              level = IDLE_PRIORITY_CLASS;
-            else if (!_tcsicmp(options.argument, TEXT("NORMAL")))
-              level = NORMAL_PRIORITY_CLASS;
-            else if (!_tcsicmp(options.argument, TEXT("REALTIME")))
-              level = REALTIME_PRIORITY_CLASS;
-            else
-              throw option_error(string(TEXT("Invalid argument '")) + options.argument + TEXT("' for option --level"));
-          }
+          priority_options.budget = _tcstoul(options.argument, &test, 10);
+          if (*test != 0 || priority_options.budget == 0 || priority_options.budget > 100)
+            throw option_error(string(TEXT("Invalid argument '")) + options.argument + TEXT("' for option --auto (must be from 1 to 100)"));
           break;
         }
-        case TEXT('t'):
-          test = true;
+        case TEXT('e'):
+          priority_options.interval_ms = parse_duration_option(options);
           break;
         default:
           if (selector.handle_option(options))
@@ -147,31 +192,96 @@ int command_line_main(int argc, char_t * argv[])
       }
     }
 
-    selector.validate_options(test);
+    if (level_argument != 0)
+    {
+      const bool valid = (priority_options.io ? parse_io_priority_level(level_argument, priority_options.level) :
+          parse_priority_level(level_argument, priority_options.level));
+      if (!valid)
+        throw option_error(string(TEXT("Invalid argument '")) + level_argument + TEXT("' for option --level"));
+      if (priority_options.io && priority_options.level > max_settable_io_priority)
+        throw option_error(string(TEXT("Invalid argument '")) + level_argument +
+            TEXT("' for option --level (the I/O priority must be VERY_LOW, LOW, NORMAL, or HIGH)"));
+    }
+    if (priority_options.io && level_argument == 0 && !priority_options.test)
+      throw option_error(TEXT("Option --io requires --level or --test"));
+
+    const bool watch = !priority_options.rule_file.empty();
+    if (watch && (priority_options.test || level_argument != 0 || priority_options.io))
+      throw option_error(TEXT("Option --watch cannot be used with --level, --test, or --io"));
+    if (watch && client.is_remote())
+      throw option_error(TEXT("Option --watch cannot be used with --computer"));
+
+    const bool automatic = (priority_options.budget != 0);
+    if (automatic && (watch || priority_options.test || priority_options.io))
+      throw option_error(TEXT("Option --auto cannot be used with --watch, --test, or --io"));
+    if (automatic && client.is_remote())
+      throw option_error(TEXT("Option --auto cannot be used with --computer"));
+    if (automatic && level_argument == 0)
+      priority_options.level = IDLE_PRIORITY_CLASS;
+
+    if (priority_options.interval_ms != 0 && !watch && !automatic)
+      throw option_error(TEXT("Option --every can only be used with --watch or --auto"));
+    if (priority_options.interval_ms == 0)
+      priority_options.interval_ms = (automatic ? 1000 : 100);
+    selector.validate_options(priority_options.test || watch || automatic);
+
+    // A bad rule file is an error for the whole run, not a result of the first pass
+    std::vector<priority_rule> rules;
+    if (watch)
+      rules = load_priority_rules(priority_options.rule_file);
 
     if (results.xml)
     {
-      results.buffer += TEXT('<') + name + TEXT(" version='1.0'>");
-      if (test)
+      results.buffer += TEXT('<') + name + TEXT(" version='1.4'>");
+      if (automatic)
+        results.report_info(TEXT("action='auto' budget_percent='") + to_string(priority_options.budget) +
+            TEXT("' level=") + make_xml_attribute_value(priority_name(priority_options.level)) +
+            TEXT(" interval_ms='") + to_string(priority_options.interval_ms) + TEXT('\''));
+      else if (watch)
+        results.report_info(TEXT("action='watch' rule_file=") + make_xml_attribute_value(priority_options.rule_file) +
+            TEXT(" interval_ms='") + to_string(priority_options.interval_ms) + TEXT('\''));
+      else if (priority_options.io && priority_options.test)
+        results.report_info(TEXT("action='test io'"));
+      else if (priority_options.io)
+        results.report_info(TEXT("action='set io'"));
+      else if (priority_options.test)
         results.report_info(TEXT("action='test'"));
       else
         results.report_info(TEXT("action='set level'"));
-      results.report_info(selector.xml_attribute());
+      const std::vector<string> targets = selector.xml_attributes();
+      for (std::vector<string>::const_iterator i = targets.begin(); i != targets.end(); ++i)
+        results.report_info(*i);
     }
 
     // Handle local requests
-    if (!client.is_remote())
-      ntpriority(true, selector, level, test);
+    if (automatic)
+      ntpriority_auto(selector, priority_options);
+    else if (watch)
+      ntpriority_watch(selector, rules, priority_options);
+    else if (!client.is_remote())
+      ntpriority(true, selector, priority_options);
     else
     {
       // Construct the message to be sent
       string msg;
-      if (test)
+      if (priority_options.io && priority_options.test)
+        msg += TEXT('q');
+      else if (priority_options.io)
+      {
+        msg += TEXT('o');
+        encode_binary_data<DWORD>(msg, priority_options.level);
+      }
+      else if (priority_options.test)
         msg += TEXT('t');
       else
       {
         msg += TEXT('l');
-        encode_binary_data<DWORD>(msg, level);
+        encode_binary_data<DWORD>(msg, priority_options.level);
+      }
+      if (priority_options.jobs != 1)
+      {
+        msg += TEXT('j');
+        encode_binary_data<DWORD>(msg, priority_options.jobs);
       }
 
       selector.encode_target(msg);
@@ -21,13 +21,22 @@ struct server: server_framework<server>
   {
     // Message format:
     //  Action (1 char): s(uspend), r(esume), or t(est)
-    //  Target (optional for Test action):
+    //  Options (optional, each 1 char):
+    //    a: suspend/resume each process with a single call
+    //    o: test by suspending and resuming each thread
+    //    j, followed by DWORD of the number of processes to act on at once
+    //    d: also act on all descendants
+    //    f, followed by DWORD of the number of milliseconds after which to resume
+    //    S: collect and report timing statistics
+    //  Targets (optional for Test action), repeated up to the end of the message:
     //    i, followed by DWORD of pid
     //    n, followed by length-prefixed string of name
     //    s, followed by length-prefixed string of name (substring match)
+    //    p, followed by DWORD of parent pid (filter)
+    //    c, followed by DWORD of minimum thread count (filter)
+    //    b, followed by LONG of base priority limit (filter)
 
-    bool resume = false;
-    bool test = false;
+    ntsuspend_options options;
     process_selector selector;
 
     if (msg.size() == i)
@@ -36,14 +45,28 @@ struct server: server_framework<server>
     switch (msg[i++])
     {
       case TEXT('s'): break;
-      case TEXT('r'): resume = true; break;
-      case TEXT('t'): test = true; break;
+      case TEXT('r'): options.resume = true; break;
+      case TEXT('t'): options.test = true; break;
       default: throw error(TEXT("Invalid message received: unknown action"));
     }
 
+    for (bool more_options = true; more_options && msg.size() != i; )
+    {
+      switch (msg[i])
+      {
+        case TEXT('a'): options.atomic = true; ++i; break;
+        case TEXT('o'): options.probe = true; ++i; break;
+        case TEXT('j'): ++i; options.jobs = decode_jobs(i, msg); break;
+        case TEXT('d'): options.tree = true; ++i; break;
+        case TEXT('f'): ++i; options.duration_ms = decode_binary_data<DWORD>(i, msg, TEXT("duration")); break;
+        case TEXT('S'): options.stats = true; ++i; break;
+        default: more_options = false;
+      }
+    }
+
     if (msg.size() == i)
     {
-      if (!test)
+      if (!options.test)
         throw error(TEXT("Invalid message received: no target"));
     }
     else
@@ -52,7 +75,10 @@ struct server: server_framework<server>
     if (msg.size() != i)
       throw error(TEXT("Invalid message received: extra data"));
 
-    ntsuspend(false, selector, resume, test);
+    if (options.duration_ms != 0 && (options.resume || options.test))
+      throw error(TEXT("Invalid message received: duration given for resume or test"));
+
+    ntsuspend(false, selector, options);
   }
 };
 
@@ -70,8 +96,19 @@ int usage()
   tcerr(TEXT("  -i [ --pid ] arg        : Specify process id\n"));
   tcerr(TEXT("  -n [ --name ] arg       : Specify process name\n"));
   tcerr(TEXT("  -s [ --substr ]         :   Process name is a substring match\n"));
+  tcerr(TEXT("  -P [ --parent ] arg     : Only select children of this process id\n"));
+  tcerr(TEXT("  -T [ --threads ] arg    : Only select processes with at least 'arg' threads\n"));
+  tcerr(TEXT("  -B [ --below ] arg      : Only select processes with a base priority below 'arg'\n"));
+  tcerr(TEXT("                          'arg' may be a numerical value or a level name\n"));
   tcerr(TEXT("  -r [ --resume ]         : Resume instead of suspend\n"));
   tcerr(TEXT("  -t [ --test ]           : Test process(es) for suspension\n"));
+  tcerr(TEXT("  -o [ --probe ]          :   Test by suspending and resuming each thread\n"));
+  tcerr(TEXT("  -a [ --atomic ]         : Suspend/resume each process with a single call\n"));
+  tcerr(TEXT("  -j [ --jobs ] arg       : Act on up to 'arg' processes at once (default 1)\n"));
+  tcerr(TEXT("  -d [ --tree ]           : Also act on all descendants of the process(es)\n"));
+  tcerr(TEXT("  -f [ --for ] arg        : Resume suspended process(es) after 'arg'\n"));
+  tcerr(TEXT("                          'arg' is a number followed by ms, s (default), m, or h\n"));
+  tcerr(TEXT("  -S [ --stats ]          : Report timing statistics\n"));
   tcerr(TEXT("  -c [ --computer ] arg   : Execute on remote computer\n"));
   tcerr(TEXT("  -u [ --username ] arg   :   Username for remote computer\n"));
   tcerr(TEXT("  -p [ --password ] [arg] :   Password for remote computer\n"));
@@ -80,14 +117,23 @@ int usage()
 
 int command_line_main(int argc, char_t * argv[])
 {
-  boost::array<option_def, 10> option_defs = { {
+  boost::array<option_def, 19> option_defs = { {
       { TEXT('h'), TEXT("help") },
       { TEXT('x'), TEXT("xml") },
       { TEXT('i'), TEXT("pid"), option_def::required_argument },
       { TEXT('n'), TEXT("name"), option_def::required_argument },
       { TEXT('s'), TEXT("substr") },
+      { TEXT('P'), TEXT("parent"), option_def::required_argument },
+      { TEXT('T'), TEXT("threads"), option_def::required_argument },
+      { TEXT('B'), TEXT("below"), option_def::required_argument },
       { TEXT('r'), TEXT("resume") },
       { TEXT('t'), TEXT("test") },
+      { TEXT('o'), TEXT("probe") },
+      { TEXT('a'), TEXT("atomic") },
+      { TEXT('j'), TEXT("jobs"), option_def::required_argument },
+      { TEXT('d'), TEXT("tree") },
+      { TEXT('f'), TEXT("for"), option_def::required_argument },
+      { TEXT('S'), TEXT("stats") },
       { TEXT('c'), TEXT("computer"), option_def::required_argument },
       { TEXT('u'), TEXT("username"), option_def::required_argument },
       { TEXT('p'), TEXT("password"), option_def::optional_argument }
@@ -97,8 +143,7 @@ int command_line_main(int argc, char_t * argv[])
   {
     option_parser options(argc, argv + 1, option_defs.begin(), option_defs.end());
 
-    bool resume = false;
-    bool test = false;
+    ntsuspend_options suspend_options;
     process_selector selector;
     client_def client;
     while (options.getopt())
@@ -111,10 +156,28 @@ int command_line_main(int argc, char_t * argv[])
         case TEXT('h'):
           return usage();
         case TEXT('r'):
-          resume = true;
+          suspend_options.resume = true;
           break;
         case TEXT('t'):
-          test = true;
+          suspend_options.test = true;
+          break;
+        case TEXT('a'):
+          suspend_options.atomic = true;
+          break;
+        case TEXT('o'):
+          suspend_options.probe = true;
+          break;
+        case TEXT('j'):
+          suspend_options.jobs = parse_jobs_option(options);
+          break;
+        case TEXT('d'):
+          suspend_options.tree = true;
+          break;
+        case TEXT('f'):
+          suspend_options.duration_ms = parse_duration_option(options);
+          break;
+        case TEXT('S'):
+          suspend_options.stats = true;
           break;
         default:
           if (selector.handle_option(options))
@@ -126,33 +189,59 @@ int command_line_main(int argc, char_t * argv[])
       }
     }
 
-    selector.validate_options(test);
+    selector.validate_options(suspend_options.test);
+    if (suspend_options.duration_ms != 0 && (suspend_options.resume || suspend_options.test))
+      throw option_error(TEXT("Option --for can only be used when suspending"));
 
     if (results.xml)
     {
-      results.buffer += TEXT('<') + name + TEXT(" version='1.0'>");
-      if (test)
+      results.buffer += TEXT('<') + name + TEXT(" version='1.4'>");
+      if (suspend_options.test)
         results.report_info(TEXT("action='test'"));
-      else if (resume)
+      else if (suspend_options.resume)
         results.report_info(TEXT("action='resume'"));
       else
         results.report_info(TEXT("action='suspend'"));
-      results.report_info(selector.xml_attribute());
+      if (suspend_options.tree)
+        results.report_info(TEXT("scope='tree'"));
+      if (suspend_options.duration_ms != 0)
+        results.report_info(TEXT("duration_ms='") + to_string(suspend_options.duration_ms) + TEXT('\''));
+      const std::vector<string> targets = selector.xml_attributes();
+      for (std::vector<string>::const_iterator i = targets.begin(); i != targets.end(); ++i)
+        results.report_info(*i);
     }
 
     // Handle local requests
     if (!client.is_remote())
-      ntsuspend(true, selector, resume, test);
+      ntsuspend(true, selector, suspend_options);
     else
     {
       // Construct the message to be sent
       string msg;
-      if (test)
+      if (suspend_options.test)
         msg += TEXT('t');
-      else if (resume)
+      else if (suspend_options.resume)
         msg += TEXT('r');
       else
         msg += TEXT('s');
+      if (suspend_options.atomic)
+        msg += TEXT('a');
+      if (suspend_options.probe)
+        msg += TEXT('o');
+      if (suspend_options.jobs != 1)
+      {
+        msg += TEXT('j');
+        encode_binary_data<DWORD>(msg, suspend_options.jobs);
+      }
+      if (suspend_options.tree)
+        msg += TEXT('d');
+      if (suspend_options.duration_ms != 0)
+      {
+        msg += TEXT('f');
+        encode_binary_data<DWORD>(msg, suspend_options.duration_ms);
+      }
+      if (suspend_options.stats)
+        msg += TEXT('S');
 
       selector.encode_target(msg);
 
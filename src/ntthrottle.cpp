@@ -0,0 +1,301 @@
+// Copyright 2005, Stephen Cleary
+// See the accompanying file "ntutils.chm" for licence information
+
+#include <windows.h>
+
+#include <boost/array.hpp>
+
+#include "ntthrottle.inc"
+#include "ntutils/remote_framework.h"
+
+static const DWORD max_response_size = 8192;
+
+static const string name = TEXT("ntthrottle");
+
+program_results results;
+
+static void validate_group(const string & group)
+{
+  if (group.empty() || group.find(TEXT('\\')) != string::npos)
+    throw error(TEXT("Invalid group name '") + group + TEXT("'"));
+}
+
+struct server: server_framework<server>
+{
+  static inline const string & name() { return ::name; }
+  static inline void handle_message(unsigned & i, const string & msg)
+  {
+    // Message format:
+    //  Action (1 char): s(et) or t(est)
+    //  Group: length-prefixed string of group name
+    //  Options (optional):
+    //    w, followed by DWORD of CPU weight
+    //    r, followed by DWORD of CPU rate (in hundredths of a percent)
+    //    j, followed by DWORD of the number of processes to act on at once
+    //  Targets (optional), repeated up to the end of the message:
+    //    i, followed by DWORD of pid
+    //    n, followed by length-prefixed string of name
+    //    s, followed by length-prefixed string of name (substring match)
+    //    p, followed by DWORD of parent pid (filter)
+    //    c, followed by DWORD of minimum thread count (filter)
+    //    b, followed by LONG of base priority limit (filter)
+
+    ntthrottle_options options;
+    process_selector selector;
+
+    if (msg.size() == i)
+      throw error(TEXT("Invalid message received: no action"));
+
+    switch (msg[i++])
+    {
+      case TEXT('s'): break;
+      case TEXT('t'): options.test = true; break;
+      default: throw error(TEXT("Invalid message received: unknown action"));
+    }
+
+    options.group = decode_string(i, msg, TEXT("group"));
+    validate_group(options.group);
+
+    for (bool more_options = true; more_options && msg.size() != i; )
+    {
+      switch (msg[i])
+      {
+        case TEXT('w'):
+          ++i;
+          options.weight = decode_binary_data<DWORD>(i, msg, TEXT("weight"));
+          if (options.weight < min_cpu_weight || options.weight > max_cpu_weight)
+            throw error(TEXT("Invalid message received: invalid weight"));
+          break;
+        case TEXT('r'):
+          ++i;
+          options.rate = decode_binary_data<DWORD>(i, msg, TEXT("rate"));
+          if (options.rate == 0 || options.rate > max_cpu_rate)
+            throw error(TEXT("Invalid message received: invalid rate"));
+          break;
+        case TEXT('j'): ++i; options.jobs = decode_jobs(i, msg); break;
+        default: more_options = false;
+      }
+    }
+
+    if (msg.size() != i)
+      selector.decode_target(i, msg);
+
+    if (msg.size() != i)
+      throw error(TEXT("Invalid message received: extra data"));
+
+    ntthrottle(false, selector, options);
+  }
+};
+
+struct client_def: client_framework<client_def>
+{
+  static inline const string & name() { return server::name(); }
+};
+
+// Parses a percentage with up to two decimal places into hundredths of a percent
+static DWORD parse_rate_option(const option_parser & options)
+{
+  char_t * end;
+  DWORD ret = _tcstoul(options.argument, &end, 10) * 100;
+  if (end != options.argument && *end == TEXT('.'))
+  {
+    DWORD scale = 10;
+    for (++end; *end >= TEXT('0') && *end <= TEXT('9') && scale != 0; ++end, scale /= 10)
+      ret += (*end - TEXT('0')) * scale;
+  }
+  if (end == options.argument || *end != 0 || ret == 0 || ret > max_cpu_rate)
+    throw option_error(string(TEXT("Invalid argument '")) + options.argument + TEXT("' for option --rate (must be from 0.01 to 100)"));
+  return ret;
+}
+
+int usage()
+{
+  tcerr(TEXT("Usage: ntthrottle [options]\n"));
+  tcerr(TEXT("Options:\n"));
+  tcerr(TEXT("  -h [ --help ]           : Display this information\n"));
+  tcerr(TEXT("  -x [ --xml ]            : Output XML\n"));
+  tcerr(TEXT("  -i [ --pid ] arg        : Specify process id\n"));
+  tcerr(TEXT("  -n [ --name ] arg       : Specify process name\n"));
+  tcerr(TEXT("  -s [ --substr ]         :   Process name is a substring match\n"));
+  tcerr(TEXT("  -P [ --parent ] arg     : Only select children of this process id\n"));
+  tcerr(TEXT("  -T [ --threads ] arg    : Only select processes with at least 'arg' threads\n"));
+  tcerr(TEXT("  -B [ --below ] arg      : Only select processes with a base priority below 'arg'\n"));
+  tcerr(TEXT("                          'arg' may be a numerical value or a level name\n"));
+  tcerr(TEXT("  -g [ --group ] arg      : Name of the group to put process(es) in\n"));
+  tcerr(TEXT("  -w [ --weight ] arg     : Set CPU weight of the group (1 to 9)\n"));
+  tcerr(TEXT("  -r [ --rate ] arg       : Limit CPU use of the group to 'arg' percent\n"));
+  tcerr(TEXT("  -t [ --test ]           : Test CPU limit and usage of the group\n"));
+  tcerr(TEXT("  -j [ --jobs ] arg       : Act on up to 'arg' processes at once (default 1)\n"));
+  tcerr(TEXT("  -c [ --computer ] arg   : Execute on remote computer\n"));
+  tcerr(TEXT("  -u [ --username ] arg   :   Username for remote computer\n"));
+  tcerr(TEXT("  -p [ --password ] [arg] :   Password for remote computer\n"));
+  return 1;
+}
+
+int command_line_main(int argc, char_t * argv[])
+{
+  boost::array<option_def, 16> option_defs = { {
+      { TEXT('h'), TEXT("help") },
+      { TEXT('x'), TEXT("xml") },
+      { TEXT('i'), TEXT("pid"), option_def::required_argument },
+      { TEXT('n'), TEXT("name"), option_def::required_argument },
+      { TEXT('s'), TEXT("substr") },
+      { TEXT('P'), TEXT("parent"), option_def::required_argument },
+      { TEXT('T'), TEXT("threads"), option_def::required_argument },
+      { TEXT('B'), TEXT("below"), option_def::required_argument },
+      { TEXT('g'), TEXT("group"), option_def::required_argument },
+      { TEXT('w'), TEXT("weight"), option_def::required_argument },
+      { TEXT('r'), TEXT("rate"), option_def::required_argument },
+      { TEXT('t'), TEXT("test") },
+      { TEXT('j'), TEXT("jobs"), option_def::required_argument },
+      { TEXT('c'), TEXT("computer"), option_def::required_argument },
+      { TEXT('u'), TEXT("username"), option_def::required_argument },
+      { TEXT('p'), TEXT("password"), option_def::optional_argument }
+  } };
+
+  try
+  {
+    option_parser options(argc, argv + 1, option_defs.begin(), option_defs.end());
+
+    ntthrottle_options throttle_options;
+    process_selector selector;
+    client_def client;
+    while (options.getopt())
+    {
+      if (!options.option)
+        throw option_error(string(TEXT("Missing option for argument '")) + options.argument + TEXT("'"));
+
+      switch (options.option->short_option)
+      {
+        case TEXT('h'):
+          return usage();
+        case TEXT('g'):
+          throttle_options.group = options.argument;
+          try
+          {
+            validate_group(throttle_options.group);
+          }
+          catch (const error & e)
+          {
+            throw option_error(e.twhat());
+          }
+          break;
+        case TEXT('w'):
+        {
+          char_t * test;
+          throttle_options.weight = _tcstoul(options.argument, &test, 0);
+          if (*test != 0 || throttle_options.weight < min_cpu_weight || throttle_options.weight > max_cpu_weight)
+            throw option_error(string(TEXT("Invalid argument '")) + options.argument + TEXT("' for option --weight (must be from 1 to 9)"));
+          break;
+        }
+        case TEXT('r'):
+          throttle_options.rate = parse_rate_option(options);
+          break;
+        case TEXT('t'):
+          throttle_options.test = true;
+          break;
+        case TEXT('j'):
+          throttle_options.jobs = parse_jobs_option(options);
+          break;
+        default:
+          if (selector.handle_option(options))
+            break;
+          if (client.handle_option(options))
+            break;
+          if (results.handle_option(options))
+            break;
+      }
+    }
+
+    if (throttle_options.group.empty())
+      throw option_error(TEXT("No group specified"));
+    if (throttle_options.weight != 0 && throttle_options.rate != 0)
+      throw option_error(TEXT("Options --weight and --rate cannot be used together"));
+    if (throttle_options.test && (throttle_options.weight != 0 || throttle_options.rate != 0 || selector.has_targets()))
+      throw option_error(TEXT("Option --test cannot be used with --weight, --rate, or process selection"));
+    if (!throttle_options.test && throttle_options.weight == 0 && throttle_options.rate == 0 && !selector.has_targets())
+      throw option_error(TEXT("Nothing to do: specify --weight, --rate, processes, or --test"));
+    if (selector.has_targets())
+      selector.validate_options(false);
+
+    if (results.xml)
+    {
+      results.buffer += TEXT('<') + name + TEXT(" version='1.0'>");
+      if (throttle_options.test)
+        results.report_info(TEXT("action='test'"));
+      else
+        results.report_info(TEXT("action='set'"));
+      if (throttle_options.weight != 0)
+        results.report_info(TEXT("weight='") + to_string(throttle_options.weight) + TEXT('\''));
+      if (throttle_options.rate != 0)
+        results.report_info(TEXT("rate='") + format_rate(throttle_options.rate) + TEXT('\''));
+      const std::vector<string> targets = selector.xml_attributes();
+      for (std::vector<string>::const_iterator i = targets.begin(); i != targets.end(); ++i)
+        results.report_info(*i);
+    }
+
+    // Handle local requests
+    if (!client.is_remote())
+      ntthrottle(true, selector, throttle_options);
+    else
+    {
+      // Construct the message to be sent
+      string msg;
+      if (throttle_options.test)
+        msg += TEXT('t');
+      else
+        msg += TEXT('s');
+      encode_string(msg, throttle_options.group);
+      if (throttle_options.weight != 0)
+      {
+        msg += TEXT('w');
+        encode_binary_data<DWORD>(msg, throttle_options.weight);
+      }
+      if (throttle_options.rate != 0)
+      {
+        msg += TEXT('r');
+        encode_binary_data<DWORD>(msg, throttle_options.rate);
+      }
+      if (throttle_options.jobs != 1)
+      {
+        msg += TEXT('j');
+        encode_binary_data<DWORD>(msg, throttle_options.jobs);
+      }
+
+      selector.encode_target(msg);
+
+      // Handle remote requests
+      client.start(msg, max_response_size);
+    }
+
+    if (results.xml)
+      results.buffer += TEXT("</") + name + TEXT(">\n");
+
+    tcout(results.buffer);
+    return results.return_code();
+  }
+  catch (const option_error & e)
+  {
+    tcerr(e.twhat() + TEXT('\n'));
+    return usage();
+  }
+  catch (const std::exception & e)
+  {
+    tcerr("Error: " + ANSI_string(e.what()) + '\n');
+    return 1;
+  }
+
+  return 0;
+}
+
+int main(int argc, char * argv[])
+{
+  // We can act as though invoked from the command line if StartServiceCtrlDispatcher fails,
+  //  and that would work; however, StartServiceCtrlDispatcher may delay for several seconds.
+  // So instead, we pass a secret parameter "service" when running as a service
+
+  if (argc == 2 && !_tcscmp(argv[1], TEXT("service")))
+    return server::start();
+  else
+    return command_line_main(argc, argv);
+}